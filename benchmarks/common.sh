@@ -0,0 +1,41 @@
+#
+# Setup shared by the benchmark and check scripts, sourced by them after 'set -e'
+#
+# Sets ROOT (the repository), CC and CFLAGS (from the environment, cc and -O2 if not set)
+# and WORK (a temporary directory removed at exit), then defines:
+# - build name [flags...]: builds main.c with CC, CFLAGS and the flags into $WORK/name
+# - best_time runs input output command [arguments...]: runs the command the given number of times,
+#   reading the input and writing the output, and prints the time of the fastest run in seconds
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+WORK=$(mktemp -d)
+
+trap 'rm -rf "$WORK"' EXIT
+
+build() {
+	name=$1
+	shift
+
+	$CC -std=gnu11 $CFLAGS "$@" -o "$WORK/$name" "$ROOT/main.c" -lm
+}
+
+best_time() {
+	runs=$1
+	input=$2
+	output=$3
+	shift 3
+
+	best=""
+
+	for run in $(seq "$runs"); do
+		start=$(date +%s.%N)
+		"$@" < "$input" > "$output"
+		end=$(date +%s.%N)
+
+		best=$(echo "$start $end $best" | awk '{ time = $2 - $1; print ($3 == "" || time < $3) ? time : $3 }')
+	done
+
+	echo "$best"
+}
@@ -0,0 +1,239 @@
+/*
+ * Compares the open addressing hash table of the engine with the chained table it replaced
+ *
+ * Both tables get the same IDs (R_Giskard_Reventlov_NNNNNNN), then are timed on random lookups
+ * of present IDs (hits) and of missing ones (misses), and on deleting every ID.
+ * The chained table is the one of the engine before open addressing: buckets of entities linked
+ * by a 'next' pointer, doubled incrementally when there is more than one entity per bucket.
+ *
+ * Build and run from the root of the repository:
+ *	cc -std=gnu11 -O2 -o hash_chaining benchmarks/hash_chaining.c -lm
+ *	./hash_chaining [ids] [lookups]
+ */
+#define main graph_main
+#include "../main.c"
+#undef main
+
+#define CHAIN_DIMENSION 1024		//Initial number of buckets, always a power of 2
+#define CHAIN_REHASH_STEP 8		//Buckets moved to the new table at every operation while growing
+
+typedef struct chained_t {
+	char 			*id;		//Entity ID, terminated by '\0'
+	unsigned int 		id_length;	//Length of the ID
+	uint64_t 		hash;		//Hash of the ID
+	struct chained_t 	*next;		//Next element in the chain
+} chained_t;
+
+typedef struct {
+	chained_t 		**table;	//Buckets where new entities are inserted
+	unsigned long 		size;		//Number of buckets of 'table'
+	chained_t 		**old_table;	//Buckets being moved into 'table' while growing, NULL otherwise
+	unsigned long 		old_size;	//Number of buckets of 'old_table'
+	unsigned long 		rehash_index;	//Next bucket of 'old_table' to move
+	unsigned long 		count;		//Number of entities in both tables
+} ChainTable;
+
+/*
+ * Given a ChainTable,
+ * moves up to CHAIN_REHASH_STEP buckets from the old table to the new one
+ */
+static void chain_rehash_step(ChainTable *ct) {
+	chained_t 	*cursor, *temp;
+	unsigned long 	index;
+
+	if (ct->old_table == NULL) return;
+
+	for (int i = 0; i < CHAIN_REHASH_STEP && ct->rehash_index < ct->old_size; i++) {
+		cursor = ct->old_table[ct->rehash_index];
+
+		while (cursor != NULL) {
+			temp = cursor;
+			cursor = cursor->next;
+
+			index = temp->hash & (ct->size - 1);
+			temp->next = ct->table[index];
+			ct->table[index] = temp;
+		}
+
+		ct->old_table[ct->rehash_index++] = NULL;
+	}
+
+	if (ct->rehash_index == ct->old_size) {
+		free(ct->old_table);
+		ct->old_table = NULL;
+	}
+}
+
+/*
+ * Given a ChainTable, an ID and its hash,
+ * returns the link pointing to the entity with the ID, or to the NULL at the end of its chain
+ */
+static chained_t **chain_find(ChainTable *ct, Slice id, uint64_t hash) {
+	chained_t **link = &ct->table[hash & (ct->size - 1)];
+
+	while (*link != NULL && ((*link)->hash != hash || (*link)->id_length != id.length || memcmp((*link)->id, id.start, id.length) != 0)) {
+		link = &(*link)->next;
+	}
+
+	if (*link == NULL && ct->old_table != NULL && (hash & (ct->old_size - 1)) >= ct->rehash_index) {
+		link = &ct->old_table[hash & (ct->old_size - 1)];
+
+		while (*link != NULL && ((*link)->hash != hash || (*link)->id_length != id.length || memcmp((*link)->id, id.start, id.length) != 0)) {
+			link = &(*link)->next;
+		}
+	}
+
+	return link;
+}
+
+/*
+ * Given a ChainTable and an ID not in the table,
+ * inserts it at the head of its chain, starting to double the table if there is more than one entity per bucket
+ */
+static void chain_insert(ChainTable *ct, Slice id) {
+	chained_t 	*new = malloc(sizeof(chained_t));
+	uint64_t 	hash = hash_string(id.start, id.length);
+
+	chain_rehash_step(ct);
+
+	new->id = strndup(id.start, id.length);
+	new->id_length = id.length;
+	new->hash = hash;
+	new->next = ct->table[hash & (ct->size - 1)];
+	ct->table[hash & (ct->size - 1)] = new;
+
+	if (++ct->count > ct->size && ct->old_table == NULL) {
+		ct->old_table = ct->table;
+		ct->old_size = ct->size;
+		ct->rehash_index = 0;
+
+		ct->size *= 2;
+		ct->table = calloc(ct->size, sizeof(chained_t *));
+	}
+}
+
+/*
+ * Given a ChainTable and an ID,
+ * returns the entity with the ID, NULL if not present
+ */
+static chained_t *chain_search(ChainTable *ct, Slice id) {
+	chain_rehash_step(ct);
+
+	return *chain_find(ct, id, hash_string(id.start, id.length));
+}
+
+/*
+ * Given a ChainTable and an ID,
+ * unlinks and frees the entity with the ID if present
+ */
+static void chain_delete(ChainTable *ct, Slice id) {
+	chained_t 	**link, *found;
+
+	chain_rehash_step(ct);
+
+	link = chain_find(ct, id, hash_string(id.start, id.length));
+
+	if ((found = *link) == NULL) return;
+
+	*link = found->next;
+	ct->count--;
+
+	free(found->id);
+	free(found);
+}
+
+/*
+ * Returns the current time in nanoseconds
+ */
+static double now(void) {
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+	unsigned long 	count = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	unsigned long 	lookups = argc > 2 ? strtoul(argv[2], NULL, 10) : 5000000;
+	Options 	options = { 0, 0, false, NULL, NULL, LOG_COMPACT_RECORDS };
+	ChainTable 	ct = { calloc(CHAIN_DIMENSION, sizeof(chained_t *)), CHAIN_DIMENSION, NULL, 0, 0, 0 };
+	Engine 		*engine;
+	Slice 		*ids, *missing, *queries;
+	unsigned long 	found = 0;
+	double 		start;
+
+	init_hash_seed();
+	engine = init_engine(&options, STDOUT_FILENO);
+
+	ids = malloc(count * sizeof(Slice));
+	missing = malloc(count * sizeof(Slice));
+	queries = malloc(lookups * sizeof(Slice));
+
+	for (unsigned long i = 0; i < count; i++) {
+		ids[i].start = malloc(48);
+		ids[i].length = sprintf(ids[i].start, "R_Giskard_Reventlov_%07lu", i);
+
+		missing[i].start = malloc(48);
+		missing[i].length = sprintf(missing[i].start, "R_Giskard_Reventlov_%07lu", i + count);
+	}
+
+	srand(1);
+
+	printf("%lu IDs, %lu lookups, ns per operation\n", count, lookups);
+	printf("%-10s %10s %10s\n", "", "chaining", "open");
+
+	//Inserts
+	start = now();
+	for (unsigned long i = 0; i < count; i++) chain_insert(&ct, ids[i]);
+	printf("%-10s %10.0f ", "insert", (now() - start) / count);
+
+	start = now();
+	for (unsigned long i = 0; i < count; i++) hash_insert(engine, engine->entities, ids[i]);
+	printf("%10.0f\n", (now() - start) / count);
+
+	//Lookups of present IDs, then of missing IDs
+	for (int hits = 1; hits >= 0; hits--) {
+		for (unsigned long i = 0; i < lookups; i++) {
+			queries[i] = (hits ? ids : missing)[((unsigned long) rand() * RAND_MAX + rand()) % count];
+		}
+
+		start = now();
+		for (unsigned long i = 0; i < lookups; i++) found += chain_search(&ct, queries[i]) != NULL;
+		printf("%-10s %10.0f ", hits ? "hit" : "miss", (now() - start) / lookups);
+
+		start = now();
+		for (unsigned long i = 0; i < lookups; i++) found += hash_search(engine->entities, queries[i]) != NULL;
+		printf("%10.0f\n", (now() - start) / lookups);
+	}
+
+	//Deletes
+	start = now();
+	for (unsigned long i = 0; i < count; i++) chain_delete(&ct, ids[i]);
+	printf("%-10s %10.0f ", "delete", (now() - start) / count);
+
+	start = now();
+	for (unsigned long i = 0; i < count; i++) hash_delete(engine, engine->entities, hash_search(engine->entities, ids[i]));
+	printf("%10.0f\n", (now() - start) / count);
+
+	//Every hit is found by both tables
+	if (found != 2 * lookups) {
+		fprintf(stderr, "%lu lookups found, expected %lu\n", found, 2 * lookups);
+		return 1;
+	}
+
+	clear_engine(engine);
+
+	for (unsigned long i = 0; i < count; i++) {
+		free(ids[i].start);
+		free(missing[i].start);
+	}
+
+	free(ids);
+	free(missing);
+	free(queries);
+	free(ct.table);
+	free(ct.old_table);
+
+	return 0;
+}
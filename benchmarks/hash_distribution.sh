@@ -0,0 +1,33 @@
+#!/bin/sh
+#
+# Distribution of 'hash_string' over sets of entity IDs
+#
+# Every set is added with 'addent' and the probe statistics of the hash table are printed by -s,
+# for the default hash and for HASH_SIPHASH:
+# - the IDs of the public tests
+# - COUNT IDs of the form R_Giskard_Reventlov_NNNNNNN (a long common prefix, only the last digits change)
+# - COUNT IDs of 60 digits differing only in the last 7 (a prefix much longer than the 8 bytes mixed at once)
+#
+# Usage: benchmarks/hash_distribution.sh [count], CC and CFLAGS are used to build main.c
+
+set -e
+
+. "$(dirname "$0")/common.sh"
+
+COUNT=${1:-200000}
+
+build main
+build main_siphash -DHASH_SIPHASH
+
+cat "$ROOT"/public_tests/*/*.in | awk '$1 == "addent" { print $1, $2 }' | sort -u > "$WORK/public.in"
+awk -v n="$COUNT" 'BEGIN { for (i = 0; i < n; i++) printf "addent \"R_Giskard_Reventlov_%07d\"\n", i }' > "$WORK/giskard.in"
+awk -v n="$COUNT" 'BEGIN { for (i = 0; i < n; i++) printf "addent \"%053d%07d\"\n", 0, i }' > "$WORK/long_prefix.in"
+
+for set in public giskard long_prefix; do
+	echo end >> "$WORK/$set.in"
+
+	for hash in main main_siphash; do
+		printf '%-12s %-13s ' "$set" "$hash"
+		"$WORK/$hash" -s < "$WORK/$set.in" 2>&1 >/dev/null | grep '^hash table'
+	done
+done
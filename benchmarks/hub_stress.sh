@@ -0,0 +1,43 @@
+#!/bin/sh
+#
+# Stress of the degree counters with hubs of millions of incoming relations
+#
+# For every D, D entities add a relation towards "hub" (and one every 1000 towards "hub2"),
+# half of them are deleted and added again, then "hub" is deleted and all of them add a relation
+# towards "hub2". A report follows every step, so they show the counts D, D / 2, D, D / 1000 and D.
+# The best of RUNS runs is printed with the reports.
+#
+# Usage: benchmarks/hub_stress.sh [runs] [D...], CC and CFLAGS are used to build main.c
+
+set -e
+
+. "$(dirname "$0")/common.sh"
+
+RUNS=${1:-3}
+
+[ $# -gt 0 ] && shift
+[ $# -gt 0 ] || set -- 1000000 2000000 4000000
+
+build main
+
+for degree in "$@"; do
+	awk -v n="$degree" 'BEGIN {
+		print "addent \"hub\"\naddent \"hub2\""
+		for (i = 0; i < n; i++) printf "addent \"f%08d\"\n", i
+		for (i = 0; i < n; i++) printf "addrel \"f%08d\" \"hub\" \"fan\"\n", i
+		for (i = 0; i < n; i += 1000) printf "addrel \"f%08d\" \"hub2\" \"fan\"\n", i
+		print "report"
+		for (i = 0; i < n; i += 2) printf "delrel \"f%08d\" \"hub\" \"fan\"\n", i
+		print "report"
+		for (i = 0; i < n; i += 2) printf "addrel \"f%08d\" \"hub\" \"fan\"\n", i
+		print "report\ndelent \"hub\"\nreport"
+		for (i = 0; i < n; i++) printf "addrel \"f%08d\" \"hub2\" \"fan\"\n", i
+		print "report\nend"
+	}' > "$WORK/stress.in"
+
+	best=$(best_time "$RUNS" "$WORK/stress.in" "$WORK/stress.out" "$WORK/main")
+
+	printf 'D = %-8d %6.2fs   ' "$degree" "$best"
+	tr -d '\n' < "$WORK/stress.out" | sed 's/; *"/;  "/g'
+	echo
+done
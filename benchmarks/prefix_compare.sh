@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# Packed ID prefixes against plain memcmp when comparing IDs
+#
+# COUNT entities are added with 'addent', every one walks the 'order' tree comparing IDs,
+# with the default build and with COMPARE_MEMCMP (memcmp only), on two sets of IDs:
+# - random: random IDs of 8 to 16 characters of the alphabet of the prefixes
+# - shared: the same IDs after 'customer_account_', so every prefix is the same and memcmp decides
+# The best of RUNS runs is printed, and the outputs of the two builds must be the same
+#
+# Usage: benchmarks/prefix_compare.sh [count] [runs], CC and CFLAGS are used to build main.c
+
+set -e
+
+. "$(dirname "$0")/common.sh"
+
+COUNT=${1:-2000000}
+RUNS=${2:-3}
+
+build main
+build main_memcmp -DCOMPARE_MEMCMP
+
+for set in random shared; do
+	awk -v n="$COUNT" -v set="$set" 'BEGIN {
+		srand(11)
+		alphabet = "-0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ_abcdefghijklmnopqrstuvwxyz"
+
+		for (i = 0; i < n; i++) {
+			id = set == "shared" ? "customer_account_" : ""
+			length_ = 8 + int(rand() * 9)
+
+			for (c = 0; c < length_; c++) id = id substr(alphabet, 1 + int(rand() * 64), 1)
+
+			printf "addent \"%s\"\n", id
+		}
+
+		print "report"
+		print "end"
+	}' > "$WORK/$set.in"
+
+	for compare in main main_memcmp; do
+		best=$(best_time "$RUNS" "$WORK/$set.in" "$WORK/${set}_$compare.out" "$WORK/$compare")
+
+		printf '%-7s %-12s %6.2fs\n' "$set" "$compare" "$best"
+	done
+
+	cmp -s "$WORK/${set}_main.out" "$WORK/${set}_main_memcmp.out" || { echo "$set: different output"; exit 1; }
+done
@@ -0,0 +1,105 @@
+#!/bin/sh
+#
+# Entity sets on skewed synthetic graphs, a few hubs and a long tail of entities with a few relations
+#
+# - hubs: 300000 entities, every one adds a relation of type "fan" towards the 8 hubs and 1 to 3 random
+#   other entities, with a report every 50000. Then one entity every 3 deletes its relation towards
+#   a hub and the first 4 hubs are deleted, each step followed by a report
+# - zipf: 200000 entities and COMMANDS commands over the types "follows", "likes" and "blocks",
+#   from a random entity to one taken with weight 1 / (rank + 1)^1.1 (the ranks shuffled):
+#   85% addrel, 13% delrel, 1.95% report and 0.05% delent followed by addent of the same entity
+# The best of RUNS runs is printed.
+#
+# Usage: benchmarks/skewed_graphs.sh [runs] [commands], CC and CFLAGS are used to build main.c
+
+set -e
+
+. "$(dirname "$0")/common.sh"
+
+RUNS=${1:-3}
+COMMANDS=${2:-2000000}
+
+build main
+
+awk 'BEGIN {
+	srand(3)
+	n = 300000
+	hubs = 8
+
+	for (i = 0; i < n; i++) printf "addent \"h%06d\"\n", i
+
+	for (k = 0; k < n; k++) {
+		for (h = 0; h < hubs; h++) printf "addrel \"h%06d\" \"h%06d\" \"fan\"\n", k, h
+		for (j = 1 + int(rand() * 3); j > 0; j--) printf "addrel \"h%06d\" \"h%06d\" \"fan\"\n", k, hubs + int(rand() * (n - hubs))
+		if (k % 50000 == 0) print "report"
+	}
+
+	for (k = 0; k < n; k += 3) printf "delrel \"h%06d\" \"h%06d\" \"fan\"\n", k, k % hubs
+	print "report"
+
+	for (h = 0; h < hubs / 2; h++) printf "delent \"h%06d\"\n", h
+	print "report"
+	print "end"
+}' > "$WORK/hubs.in"
+
+awk -v commands="$COMMANDS" '
+# Returns an entity taken with weight 1 / (rank + 1)^1.1, by a binary search of the cumulative weights
+function zipf(   x, low, high, middle) {
+	x = rand() * cumulative[n - 1]
+	low = 0
+	high = n - 1
+
+	while (low < high) {
+		middle = int((low + high) / 2)
+		if (cumulative[middle] < x) low = middle + 1
+		else high = middle
+	}
+
+	return rank[low]
+}
+
+BEGIN {
+	srand(1)
+	n = 200000
+	types[0] = "follows"
+	types[1] = "likes"
+	types[2] = "blocks"
+
+	for (i = 0; i < n; i++) {
+		printf "addent \"e%06d\"\n", i
+		cumulative[i] = (i > 0 ? cumulative[i - 1] : 0) + 1 / (i + 1) ^ 1.1
+		rank[i] = i
+	}
+
+	for (i = n - 1; i > 0; i--) {
+		j = int(rand() * (i + 1))
+		swap = rank[i]
+		rank[i] = rank[j]
+		rank[j] = swap
+	}
+
+	for (k = 0; k < commands; k++) {
+		type = types[int(rand() * 3)]
+		from = int(rand() * n)
+		x = rand()
+
+		if (x < 0.85) {
+			printf "addrel \"e%06d\" \"e%06d\" \"%s\"\n", from, zipf(), type
+		} else if (x < 0.98) {
+			printf "delrel \"e%06d\" \"e%06d\" \"%s\"\n", from, zipf(), type
+		} else if (x < 0.9995) {
+			print "report"
+		} else {
+			entity = rand() < 0.5 ? int(rand() * n) : zipf()
+			printf "delent \"e%06d\"\naddent \"e%06d\"\n", entity, entity
+		}
+	}
+
+	print "end"
+}' > "$WORK/zipf.in"
+
+for graph in hubs zipf; do
+	best=$(best_time "$RUNS" "$WORK/$graph.in" "$WORK/$graph.out" "$WORK/main")
+
+	printf '%-5s %6.2fs\n' "$graph" "$best"
+done
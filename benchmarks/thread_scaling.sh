@@ -0,0 +1,50 @@
+#!/bin/sh
+#
+# Scaling of the worker threads on relation commands and entity deletions
+#
+# COUNT commands over 32 relation types and 30000 entities: 97% are addrel towards the first 5000
+# entities, the others delete one of them and add it again (about 45000 delent for the default count),
+# with a report every 100000 commands.
+# The input is run serially (1 thread) and with 2, 4 and 8 workers, the best of RUNS runs is printed
+# and the outputs must be the same as the serial one.
+#
+# Usage: benchmarks/thread_scaling.sh [count] [runs], CC and CFLAGS are used to build main.c
+
+set -e
+
+. "$(dirname "$0")/common.sh"
+
+COUNT=${1:-1500000}
+RUNS=${2:-3}
+
+build main
+
+awk -v n="$COUNT" 'BEGIN {
+	srand(11)
+
+	for (i = 0; i < 30000; i++) printf "addent \"e%06d_yyyyyyyyyyyyyyyy\"\n", i
+
+	for (i = 0; i < n; i++) {
+		if (rand() < 0.97) {
+			printf "addrel \"e%06d_yyyyyyyyyyyyyyyy\" \"e%06d_yyyyyyyyyyyyyyyy\" \"t%02d\"\n", int(rand() * 30000), int(rand() * 5000), int(rand() * 32)
+		} else {
+			e = int(rand() * 5000)
+			printf "delent \"e%06d_yyyyyyyyyyyyyyyy\"\naddent \"e%06d_yyyyyyyyyyyyyyyy\"\n", e, e
+		}
+
+		if (i % 100000 == 0) print "report"
+	}
+
+	print "report"
+	print "end"
+}' > "$WORK/scaling.in"
+
+echo "$(grep -c '^addrel' "$WORK/scaling.in") addrel, $(grep -c '^delent' "$WORK/scaling.in") delent, $(nproc) CPUs"
+
+for threads in 1 2 4 8; do
+	[ "$threads" = 1 ] && options="" || options="-t $threads"
+	best=$(best_time "$RUNS" "$WORK/scaling.in" "$WORK/scaling_$threads.out" "$WORK/main" $options)
+
+	cmp -s "$WORK/scaling_1.out" "$WORK/scaling_$threads.out" || { echo "$threads threads: different output"; exit 1; }
+	printf '%2d threads %8.2fs\n' "$threads" "$best"
+done
@@ -0,0 +1,57 @@
+#!/bin/sh
+#
+# Cost of the command log on ingest
+#
+# 100000 entities, then three rounds of 600000 addrel and 400000 delrel between random entities
+# over 4 relation types and 20000 delent (3.16M commands), with a report at the end.
+# The input is run without the log, with -w and no compaction (-c 0) and with -w -c COMPACT,
+# the log is removed before every run, the best of RUNS runs is printed with the size of the log
+# and its checkpoint, and the outputs must be the same as the one without the log.
+#
+# Usage: benchmarks/wal_ingest.sh [runs] [compact], CC and CFLAGS are used to build main.c
+
+set -e
+
+. "$(dirname "$0")/common.sh"
+
+RUNS=${1:-3}
+COMPACT=${2:-1048576}
+LOG="$WORK/ingest.log"
+
+build main
+
+awk 'BEGIN {
+	srand(17)
+
+	for (i = 0; i < 100000; i++) printf "addent \"E%06d\"\n", i
+
+	for (round = 0; round < 3; round++) {
+		for (i = 0; i < 600000; i++) printf "addrel \"E%06d\" \"E%06d\" \"t%d\"\n", int(rand() * 100000), int(rand() * 100000), int(rand() * 4)
+		for (i = 0; i < 400000; i++) printf "delrel \"E%06d\" \"E%06d\" \"t%d\"\n", int(rand() * 100000), int(rand() * 100000), int(rand() * 4)
+		for (i = 0; i < 20000; i++) printf "delent \"E%06d\"\n", int(rand() * 100000)
+	}
+
+	print "report"
+	print "end"
+}' > "$WORK/ingest.in"
+
+# Runs main.c on a new log, a log left by the previous run would be recovered first
+ingest() {
+	rm -f "$LOG" "$LOG.ckp"
+	"$WORK/main" "$@"
+}
+
+for mode in none nocompact compact; do
+	case $mode in
+		none) label="no log"; set -- ;;
+		nocompact) label="-w -c 0"; set -- -w "$LOG" -c 0 ;;
+		compact) label="-w -c $COMPACT"; set -- -w "$LOG" -c "$COMPACT" ;;
+	esac
+
+	best=$(best_time "$RUNS" "$WORK/ingest.in" "$WORK/ingest_$mode.out" ingest "$@")
+
+	cmp -s "$WORK/ingest_none.out" "$WORK/ingest_$mode.out" || { echo "$label: different output"; exit 1; }
+	printf '%-16s %6.2fs' "$label" "$best"
+	[ "$mode" = none ] || printf '   log %d bytes, checkpoint %d bytes' "$(wc -c < "$LOG")" "$(cat "$LOG.ckp" 2>/dev/null | wc -c)"
+	echo
+done
@@ -10,40 +10,236 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+
+#define HASH_DIMENSION 1024		//Initial number of slots, always a power of 2
+#define HASH_MAX_LOAD 7			//Eighths of the slots that can be used before the table grows
+#define HASH_REHASH_STEP 8		//Groups of slots moved to the new table at every operation while growing
+#define HUGE_PAGE_BYTES (1 << 21)	//Size of a huge page, the arrays of the hash table at least this big are aligned to it
+#define ENTITY_QUOTED_ID 32		//Bytes of the quoted ID kept inside the entity, longer IDs are allocated apart
+
+#define POOL_SLAB_OBJECTS 1024		//Objects allocated at once by a pool when its free list is empty
+
+#define INPUT_BLOCK (1 << 20)		//Bytes read at once when the input is not a regular file
+#define TOKEN_BLOCK 64			//Bytes of input scanned at once for separators
+#define OUTPUT_BUFFER (1 << 16)		//Bytes of output buffered before writing them at once
+
+#define TASK_BATCH 1024			//Relation commands handed at once to a worker thread
+
+#define INDEX_PAGE_BITS 16		//A page of the entity indices has 2^INDEX_PAGE_BITS entities, and there are as many pages
+
+#define SET_INLINE_MEMBERS 4		//Indices stored inside an entity set, before it needs a hash table
+#define SET_MIN_CAPACITY 8		//Slots of the smallest hash table of an entity set, always a power of 2
+#define SET_MAX_LOAD 3			//Quarters of the slots of the hash table of an entity set that can be used
+#define SET_EMPTY UINT32_MAX		//Slot of an entity set not used, no entity has this index
+#define SHARD_MAX_LOAD 3		//Quarters of the slots of a SetShard that can be used
+
+#define LABEL_STEP (1ull << 32)		//Distance between the labels of entities added one after the other at the end (or the start)
+#define PREFIX_CHARS 10			//Characters of an ID packed in 6 bits each in the 'prefix' of the entity
+#define PREFIX_NONE UINT64_MAX		//Prefix of the IDs with characters that can't be packed
+
+#define CHECKPOINT_MAGIC "GRAPHCKP"	//First 8 bytes of a checkpoint file
+#define CHECKPOINT_VERSION 2		//Version of the checkpoint format, also rejects files written with another byte order
+
+#define LOG_MAGIC "GRAPHLOG"		//First 8 bytes of a command log
+#define LOG_VERSION 1			//Version of the command log format
+#define LOG_GROUP_BYTES (1 << 18)	//Bytes of logged commands written and synced at once
+#define LOG_COMPACT_RECORDS (1 << 22)	//Logged commands after which the log is compacted, unless given with -c
 
-#define HASH_DIMENSION 10000
+/*
+ * When defined, the input is scanned for separators one byte at a time,
+ * even if AVX2 or SSE2 are available. Useful to check the vectorized scanner against it
+ */
+//#define TOKENIZER_SCALAR
+
+/*
+ * When defined, entity IDs are hashed with SipHash-1-3 instead of the default
+ * multiply-mix hash: slower, but collisions can't be forced without knowing the key
+ */
+//#define HASH_SIPHASH
+
+/*
+ * When defined, entity IDs are always compared with memcmp, without comparing
+ * their packed prefixes first. Useful to measure the prefixes against it
+ */
+//#define COMPARE_MEMCMP
+
+/*
+ * Control bytes of the hash table slots are compared a group at a time,
+ * with AVX2 or SSE2 when available and one byte at a time otherwise
+ */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define GROUP_SIZE 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define GROUP_SIZE 16
+#else
+#define GROUP_SIZE 8
+#endif
+
+#define CTRL_EMPTY ((int8_t) 0x80)	//Slot never used
+#define CTRL_DELETED ((int8_t) 0xFE)	//Slot of a deleted entity, probing goes past it
 
 typedef struct list List;
 typedef struct tree_t Tree;
+typedef struct engine Engine;
+
+/*
+ * A string that is not terminated by '\0': a pointer to its first character and its length.
+ * Command arguments are slices of the input, so they are never copied
+ */
+typedef struct {
+	char 			*start;		//First character
+	unsigned int 		length;		//Number of characters
+} Slice;
+
+/*
+ * A growable array of bytes, used to keep the rendered 'report' of every relation type
+ */
+typedef struct {
+	char 			*bytes;		//Bytes of the buffer
+	size_t 			length;		//Number of bytes used
+	size_t 			capacity;	//Number of bytes allocated
+} Buffer;
+
+/*---------------
+ * Entity sets  *
+ *---------------
+ *
+ * The relations of an entity don't need to be sorted: 'addrel' and 'delrel' only check if
+ * a relation is present and 'delent' visits all of them, in any order. So the relations of
+ * every type are kept in an EntitySet of the dense indices of the entities (see 'Entity indices').
+ *
+ * Most entities have a few relations of a type and a few hubs have a lot of them, so a set
+ * changes the way it stores the indices as it grows, always taking the one with less memory:
+ * - SET_INLINE: up to SET_INLINE_MEMBERS indices in the set itself, nothing allocated
+ * - SET_HASH: an open addressing hash table probed linearly, doubled when more than SET_MAX_LOAD
+ *   quarters of the slots are used. A removed index is replaced by moving back the ones after it,
+ *   so there are never deleted slots
+ * - SET_BITMAP: a bit for every index up to the highest one in the set, for the hubs related
+ *   to a large part of the entities
+ *
+ * A set doesn't go back to a smaller kind when indices are removed, it's freed when its entity is deleted
+ *
+ * An entity only has the sets of the types it had relations of: a TypeSets for every one of them,
+ * in a small open addressing hash table probed linearly, so the memory doesn't depend on the number
+ * of types of the engine. The types are never removed from it, the table is freed with the entity.
+ * With worker threads the types of an entity are split in a SetShard for every worker, the one of
+ * the owner of the type: only that worker adds to it, no other thread reads it, but 'used' is
+ * written by the thread running the engine, so it skips the shards that never had a type.
+ * The shards are at the end of the entity, allocated with it
+ */
+typedef enum {SET_INLINE, SET_HASH, SET_BITMAP} SetKind;
+
+typedef struct {
+	union {
+		uint32_t 	members[SET_INLINE_MEMBERS];	//Indices of a SET_INLINE set, the first 'count' are used
+		uint32_t 	*slots;				//Slots of a SET_HASH set, SET_EMPTY if not used
+		uint64_t 	*bits;				//Words of a SET_BITMAP set, the bit of an index is set if it's in the set
+	};
+	uint32_t 		count;				//Number of entities in the set
+	uint32_t 		capacity : 30;			//Slots of a SET_HASH set, words of a SET_BITMAP set (a bitmap is taken before 2^30)
+	uint32_t 		kind : 2;			//How the indices are stored, a SetKind
+} EntitySet;
+
+typedef struct {
+	struct list_t 		*data_list;	//Report data of the type, the current one if the sets are not empty
+	EntitySet 		in;		//Entities with a relation of the type towards the entity
+	EntitySet 		out;		//Entities the entity has a relation of the type towards
+	uint32_t 		type_id;	//Id of the relation type, SET_EMPTY if the slot is not used
+} TypeSets;
+
+typedef struct {
+	TypeSets 		*slots;		//Slots of the hash table, NULL if the shard has no types
+	uint32_t 		count;		//Number of types of the shard
+	uint32_t 		capacity;	//Number of slots, always a power of 2
+	bool 			used;		//Set by the thread running the engine when the entity gets a relation of one of the types
+} SetShard;
+
+typedef struct entry_t {
+	char 			*id;		//Entity ID, not terminated by '\0': it's stored as it's printed in 'report', between double quotes and followed by a space
+	unsigned int 		id_length;	//Length of the ID, without the double quotes and the space
+	uint32_t 		index;		//Dense index of the entity, reused after the entity is deleted
+	uint64_t 		hash;		//Hash of the ID, saved so it's not recomputed when deleting the entity
+	char 			quoted[ENTITY_QUOTED_ID];	//ID pointed by 'id' if it fits, so a lookup finds it next to the hash
+	uint64_t 		label;		//Label of the entity, the labels are in the same order of the IDs
+	uint64_t 		prefix;		//First PREFIX_CHARS characters of the ID packed with 'id_prefix', compared before the ID
+	SetShard 		shards[];	//Sets of the relation types of the entity, as many shards as 'set_shards' of the engine
+} entity_t;
 
 /*-------------
  * Hash table *
  *-------------
  *
- * Collisions are handled through chaining,
- * the main array is initialized with a size of 10000 entries (HASH_DIMENSION)
+ * Collisions are handled through open addressing: every slot has a control byte
+ * with the lowest 7 bits of the hash of its entity (or CTRL_EMPTY / CTRL_DELETED),
+ * the control bytes of a group of GROUP_SIZE slots are compared at once
+ * and only the slots whose byte matches get their full hash and ID compared.
+ * Probing goes on group by group until a group with an empty slot is found.
+ * Next to the entity of every slot are the bits of its hash above the control byte,
+ * the IDs that fit are kept inside their entity: a lookup reads the control bytes, the slot
+ * and the entity, and moving a slot to a new table doesn't read the entity at all.
+ * Arrays of slots of at least HUGE_PAGE_BYTES are put in huge pages, for less TLB misses.
+ *
+ * The slots array is initialized with a size of 1024 entries (HASH_DIMENSION),
+ * or enough entries for the expected number of entities given at startup.
+ *
+ * When more than HASH_MAX_LOAD eighths of the slots are used, the table grows:
+ * the old slots are kept and moved to the new ones a few groups at a time
+ * (HASH_REHASH_STEP for every operation), so no single command pays for the whole rehash
  */
-typedef struct entry_t {
-	char 			*id;		//Entity ID
-	struct entry_t 		*next;		//Next element in the chain
-	List 			*rel_list;	//List of relation types, storing trees with the actual relation nodes
-} entity_t;
+typedef struct {
+	int8_t 			*ctrl;			//Control bytes, the first GROUP_SIZE are repeated at the end to load any group at once
+	entity_t 		**slots;		//Array of slots
+	uint32_t 		*hashes;		//Bits of the hash of the entity of every slot above the control byte, to move it without reading the entity
+	unsigned long 		size;			//Number of slots, always a power of 2
+	unsigned long 		used;			//Number of slots not empty (entities and deleted)
+} HashSlots;
 
 typedef struct {
-	entity_t 		**table;
+	HashSlots 		table;			//Slots where new entities are inserted
+	HashSlots 		old_table;		//Slots being moved into 'table' while growing, 'ctrl' is NULL otherwise
+	unsigned long 		rehash_index;		//Next slot of 'old_table' to move
+	unsigned long 		count;			//Number of entities in both tables
 } HashTable;
 
+/*-----------------
+ * Entity indices *
+ *-----------------
+ *
+ * Every entity gets a 32 bit index when it's inserted in the hash table: an index freed by
+ * a deleted entity, the most recently freed one first, or the next one never used.
+ * So the indices stay dense and can index arrays of data about the entities.
+ *
+ * The entity with a given index is found in 'pages': a page of 2^INDEX_PAGE_BITS entities is allocated
+ * the first time one of its indices is used and is never moved, so worker threads can read it
+ * while the thread running the engine inserts new entities
+ */
+typedef struct {
+	entity_t 		***pages;			//Pages of entities, NULL if none of their indices was ever used
+	uint32_t 		next;				//First index never used
+	uint32_t 		*free;				//Indices freed by the deleted entities, the last one is reused first
+	uint32_t 		free_count;			//Number of indices in 'free'
+	uint32_t 		free_capacity;			//Number of elements allocated in 'free'
+} EntityIndex;
+
 /*------------------
  * Red Black Tree  *
  *------------------
  *
- * Every entity has a list of trees (one for every relation type)
- *
- * The tree contains the relations that have the current entity has the
- * "to" of the relation
- *
- * The relation is added in 'addrel' with the format:
- * addrel "from" "to" "type
+ * The trees are used where 'report' needs the entities in alphabetic order:
+ * the entities with the same number of incoming relations of a type ('degrees' of the list)
+ * and all the entities of the engine ('order').
+ * The relations of every entity are kept in the unordered sets of its TypeSets.
  *
  * In the nodes, the entities are saved as pointers; in a 64bit architecture,
  * this saves memory if the entities have IDs longer than 8 chars, since
@@ -59,7 +255,7 @@ typedef struct node {
 struct tree_t {
 	node 			*root;	//Root of the tree. This is the only node with the parent being NIL
 
-	short unsigned int 	size;	//Number of nodes, modified in rb_insert & rb_delete, initialized as 0 in 'init_tree'
+	uint64_t 		size;	//Number of nodes, modified in rb_insert & rb_delete, initialized as 0 in 'init_tree'
 };
 
 /*
@@ -79,72 +275,363 @@ typedef enum {RED, BLACK} Color;
  * Furthermore, using linked list helps with code clarity and
  * readability instead of having trees inside trees
  *
+ * The data to print for 'report' is stored in the 'relation_types' list of the engine:
+ * every node keeps an array of trees indexed by the number of incoming relations ('degrees'),
+ * the tree at index 'd' contains all the entities with exactly 'd' incoming relations of that type.
+ * A tree is allocated the first time an entity reaches its number ('NULL' before), so a hub with millions
+ * of relations only costs a pointer for every number up to its own.
+ * The entities to report are the ones in the tree at index 'current_maximum', and when that tree
+ * gets emptied the new maximum is found by going down the array, without visiting the entities:
+ * the maximum only goes up by one at a time, so going down costs at most one step for every relation added.
  *
- * The tree is used to store "from" Entries of the 'key' relation type,
- * as well as to store the data to print when the function 'report' is called.
- *
- * The trees used to store data for 'report' are the ones in 'RELATION_TYPES' list.
+ * The part of the 'report' of every relation type is rendered once and kept in the 'types' of the engine,
+ * it's rendered again only if 'dirty' is set, when the reported entities or the maximum change.
  */
 typedef struct list_t { //Node of the list
 	char 			*key;				//Relation type name
+	unsigned int 		type_id;			//Id of the relation type in the 'types' of the engine
 	struct list_t 		*next;				//Next element in the list
-	Tree 			*tree; 				//The tree containing entities relations towards one single entity
-	short unsigned int 	current_maximum;		//The value of the maximum number of relation, it is printed for every relation type report
+	Tree 			**degrees;			//Trees of the entities grouped by number of incoming relations
+	uint64_t 		degrees_size;			//Number of elements of 'degrees'
+	uint64_t 		current_maximum;		//The value of the maximum number of relation, it is printed for every relation type report
+	bool 			dirty;				//TRUE if the type needs to be rendered again
 } list_t;
 
 struct list { //The struct containing the head of the list
 	list_t 			*head;				//Head of the list
 };
 
-/*
- * Global variable for the entities hashtable
+/*-------------
+ * Type table *
+ *-------------
+ *
+ * Every relation type name is interned once, the first time it is used in 'addrel',
+ * and gets a small id (0, 1, 2...) that indexes the arrays of trees of the entities.
+ * So a command only needs to hash the type name once, instead of searching it
+ * in the list of every entity it touches.
+ *
+ * Names are found through a small open addressing table (linear probing) of ids.
+ * Ids are never reused, the number of relation types is assumed to be low
+ */
+typedef struct {
+	char 			**names;			//Interned type names, indexed by type id
+	list_t 			**data;				//Node of 'relation_types' of every type, NULL if the type has no relations
+	Buffer 			*rendered;			//Part of the type in the last 'report' or 'reportdiff', empty if it was not printed
+	unsigned int 		count;				//Number of interned types
+	unsigned int 		capacity;			//Number of elements allocated in 'names' and 'data'
+
+	int 			*index;				//Type ids (-1 if empty), indexed by the hash of their name
+	unsigned int 		index_size;			//Number of elements of 'index', always a power of 2
+} TypeTable;
+
+/*---------
+ * Output *
+ *---------
+ *
+ * Everything printed by 'report' is copied in a buffer of OUTPUT_BUFFER bytes,
+ * written with a single 'write' when it's full and at the end of the program
  */
-HashTable 	*ENTITIES;
+typedef struct {
+	char 			*buffer;			//Bytes not written yet
+	size_t 			used;				//Number of bytes in 'buffer'
+	int 			fd;				//File descriptor where the buffer is written
+} Output;
 
-/*
- * List of relation types, the one used to store data for reporting.
- * Updated every 'addrel', 'delrel', 'delent', when necessary
+/*-------------
+ * Slab pools *
+ *-------------
+ *
+ * Nodes, trees, list nodes and entities are allocated and freed for every single relation,
+ * so instead of calling malloc and free every time, every type of object has its own pool.
+ *
+ * A pool allocates POOL_SLAB_OBJECTS objects at once (a slab) and hands them out one at a time,
+ * freed objects are put in a free list (linked through their first bytes) and reused first.
+ * Slabs are only freed by 'clear_pool', at the end of the program
  */
-List 		*RELATION_TYPES;
+typedef struct {
+	size_t 			object_size;			//Size of the objects, at least the size of a pointer
+	void 			*free_list;			//Last freed object, it points to the previous one
+	void 			*slabs;				//Last allocated slab, its first bytes point to the previous one
+	size_t 			slab_used;			//Number of objects handed out from the last slab
+
+	long 			live;				//Objects allocated minus objects freed, negative if the pool frees objects of another
+	long 			peak;				//Maximum of 'live' reached
+} Pool;
+
+#define POOL_INIT(type) { sizeof(type) > sizeof(void *) ? sizeof(type) : sizeof(void *), NULL, NULL, POOL_SLAB_OBJECTS, 0, 0 }
 
 /*
- * NIL node for the RB trees, used as a global variable for code semplicity
+ * What a thread needs to work on the RB trees of an engine: the NIL sentinel and the pools
+ * of nodes and trees. The main thread of an engine and every worker thread have their own Forest,
+ * the sentinel is the one of the engine for all of them, since it's never written
+ */
+typedef struct {
+	Engine 			*engine;			//Engine the trees belong to
+	node 			*nil;				//NIL node of the RB trees of the engine
+	Pool 			node_pool;			//Pool of the nodes allocated by the thread
+	Pool 			tree_pool;			//Pool of the trees allocated by the thread
+} Forest;
+
+/*----------
+ * Workers *
+ *----------
+ *
+ * With the -t option, 'addrel' and 'delrel' are executed by worker threads.
+ * Relation types share nothing but the entities, so every type is owned by one worker
+ * (type id modulo the number of workers) and its trees are only touched by that thread.
+ *
+ * The main thread (the one running the engine) parses the input, finds the entities and the type and appends a Task
+ * to the batch of the owner, a full batch is handed to the worker while the next one is filled.
+ * 'delent' hands a Task to every worker owning some types of the entity, that wipes them, and waits for the workers,
+ * 'report' and 'reportdiff' read every type, so they wait for all the workers first,
+ * 'hasrel' reads a single type and waits only for its owner
  */
-node 		*NIL;
+typedef enum {ADD_RELATION, DELETE_RELATION, DELETE_ENTITY} TaskKind;
 
-/*--------------------------------------------*/
-/*			Needed function prototypes		  */
-/*--------------------------------------------*/
+typedef struct {
+	entity_t 		*from;				//Entity the relation starts from, the deleted one for DELETE_ENTITY
+	entity_t 		*to;				//Entity the relation goes to, NULL for DELETE_ENTITY
+	list_t 			*data_list;			//Report data of the relation type, NULL for DELETE_ENTITY
+	TaskKind 		kind;				//Command the Task comes from
+} Task;
+
+typedef struct {
+	pthread_t 		thread;
+	pthread_mutex_t 	lock;				//Protects 'running', 'busy' and 'quit'
+	pthread_cond_t 		changed;			//Signaled when a batch is handed to the worker or executed
 
-int 		fputs_unlocked(const char *, FILE *);
+	Task 			*filling;			//Batch being filled by the main thread
+	size_t 			filling_count;			//Number of tasks in 'filling'
+	Task 			*running;			//Batch being executed by the worker
+	size_t 			running_count;			//Number of tasks in 'running'
+	bool 			busy;				//TRUE until the worker has executed 'running'
+	bool 			quit;				//TRUE when the worker has to exit
 
-node 		*init_NIL(void);
-List 		*init_list(void);
-Tree 		*init_tree(void);
-HashTable 	*init_table(void);
+	Forest 			forest;				//Pools of the worker thread, merged into the ones of the engine when it exits
+} Worker;
+
+/*--------------
+ * Command log *
+ *--------------
+ *
+ * With the -w option, every 'addent', 'delent', 'addrel' and 'delrel' is appended to a log before being executed,
+ * so the graph can be recovered after a restart without the whole input. The log starts with LOG_MAGIC,
+ * LOG_VERSION and its generation (64 bit), then every record is the kind of the command (one byte)
+ * and its arguments (32 bit length and characters), one or three.
+ *
+ * Records are buffered and written with a single 'write' and 'fdatasync' every LOG_GROUP_BYTES (group commit),
+ * before waiting for more input when none is ready, and when the engine stops. After LOG_COMPACT_RECORDS records the graph is written with 'write_checkpoint'
+ * to '<log>.ckp' with the next generation, then the log is replaced by an empty one of that generation.
+ * At startup the checkpoint is loaded and the records of the log are executed again if the log has the same
+ * generation: a log older than the checkpoint was already compacted into it before a crash
+ */
+typedef struct {
+	char 			*path;				//Path of the log, NULL if commands are not logged
+	char 			*snapshot;			//Path of the checkpoint the log is compacted into, '<path>.ckp'
+	int 			fd;				//File descriptor of the log, -1 if commands are not logged
+	Buffer 			pending;			//Records not written yet
+	uint64_t 		generation;			//Number of compactions, the same in the log and in its checkpoint
+	unsigned long 		records;			//Number of records in the log
+	unsigned long 		compact_records;		//Number of records after which the log is compacted
+} CommandLog;
+
+/*---------
+ * Engine *
+ *---------
+ *
+ * All the state of one graph, given to every function that needs it,
+ * so several engines can run in the same process, each one on its own thread
+ */
+struct engine {
+	HashTable 		*entities;			//Entities hashtable
+	EntityIndex 		indices;			//Entities by their dense index
+	Tree 			order;				//All the entities in alphabetic order, used to give them their labels
+	List 			*relation_types;		//List of relation types, the one used to store data for reporting
+	TypeTable 		*types;				//Table of the interned relation type names
+
+	node 			nil;				//NIL node of the RB trees of the engine
+	Forest 			forest;				//Sentinel and pools of the thread running the engine
+	Pool 			list_pool;			//Pool of the nodes of 'relation_types'
+	Pool 			entity_pool;			//Pool of the entities
+
+	Output 			output;				//Buffered output of the reports
+	Buffer 			report;				//Whole line printed by the last 'report', printed again as it is if 'report_dirty' is not set
+	bool 			report_dirty;			//Set whenever a relation type is added, deleted or marked dirty
+	Buffer 			render_scratch;			//Where a relation type is rendered before being compared with its previous rendering
+
+	Worker 			*workers;			//Worker threads executing 'addrel' and 'delrel', NULL if executed by the thread running the engine
+	unsigned int 		workers_count;			//Number of worker threads
+	unsigned int 		set_shards;			//Number of SetShard of every entity, one for every worker or a single one
+
+	CommandLog 		log;				//Log of the commands changing the graph
+};
+
+/*
+ * Options given to every engine
+ */
+typedef struct {
+	unsigned long 		expected_entities;		//Used to presize the hash table
+	unsigned int 		threads;			//Number of worker threads of every engine
+	bool 			pool_statistics;		//TRUE to print the live and peak objects of every pool on stderr at the end
+	char 			*checkpoint;			//Checkpoint loaded by every engine before its input, NULL if none
+	char 			*log;				//Command log of the engine, NULL if commands are not logged
+	unsigned long 		compact_records;		//Number of logged commands after which the log is compacted
+} Options;
 
-list_t 		*list_search(List *, char *);
-node 		*tree_search(node *, entity_t *);
-entity_t 	*hash_search(HashTable *, char *);
+/*-------------
+ * Checkpoint *
+ *-------------
+ *
+ * 'checkpoint' writes the whole graph to a binary file, loaded at startup with -l.
+ * All the numbers are 32 bit (64 bit for the generation and the count of entities) in the byte order of the machine:
+ *
+ *	CHECKPOINT_MAGIC, CHECKPOINT_VERSION, generation of the command log, number of types, number of entities
+ *	every type name, in id order:			length, characters
+ *	every entity ID, in alphabetic order:		length, characters
+ *	number of types with relations, then for each one, in id order:
+ *		type id, maximum, number of reported entities, their positions
+ *		number of entities with incoming relations, then for each one, in alphabetic order:
+ *			position, number of incoming relations, positions of the 'from' entities in alphabetic order
+ *
+ * Entities are referred to by their position in the alphabetic order, so every list in the file is sorted
+ * and the trees are built at once from them instead of inserting one node at a time
+ */
+typedef struct {
+	const char 		*cursor;			//Next byte to read
+	const char 		*end;				//End of the file
+	bool 			failed;				//TRUE if a read went past the end of the file
+} Reader;
 
-void 		clear_list(List *);
-void 		clear_tree(Tree *, node *, bool);
-void 		clear_hash_table(HashTable *);
+/*
+ * Commands that change the graph, as they are stored in the command log
+ */
+typedef enum {LOG_ADDENT, LOG_DELENT, LOG_ADDREL, LOG_DELREL} LogKind;
 
-list_t 		*list_insert(List *, char *);
-list_t 		*list_insert_unordered(List *, char *);
-node 		*rb_insert(Tree *, entity_t *);
-int 		hash_insert(HashTable *, char *);
+/*
+ * Independent input files replayed at the same time, each one by its own engine.
+ * Every replay thread takes the next file not replayed yet until there are none left
+ */
+typedef struct {
+	char 			**files;			//Input files, the output of every file is written to '<file>.out'
+	unsigned int 		count;				//Number of input files
+	unsigned int 		next;				//Index of the next file to replay, incremented atomically
+	Options 		*options;			//Options of the engines
+	bool 			failed;				//TRUE if a file or the checkpoint could not be opened
+} Replay;
 
-void 		list_delete(List *, char *);
-void 		rb_delete(Tree *, node *);
-int 		hash_delete(HashTable *, char *);
+/*
+ * Key of the entity IDs hash function, randomly initialized in 'init_hash_seed'.
+ * It's shared by all the engines, it's never written after its initialization
+ */
+uint64_t 	HASH_SEED[2];
 
-bool 		print_relation_tree(node *);
-void 		restore_data_maximum(list_t *, char *);
+/*--------------------------------------------*/
+/*			Needed function prototypes		  */
+/*--------------------------------------------*/
 
-void 		process_input(FILE *);
-void 		print_string(char *);
+void 		init_nil(node *);
+Engine 		*init_engine(Options *, int);
+List 		*init_list(void);
+Tree 		*init_tree(Forest *);
+HashTable 	*init_table(unsigned long);
+TypeTable 	*init_types(void);
+void 		init_slots(HashSlots *, unsigned long);
+void 		init_indices(EntityIndex *);
+void 		init_set(EntitySet *);
+void 		init_hash_seed(void);
+uint64_t 	hash_string(char *, unsigned int);
+
+node 		*tree_search(Forest *, node *, entity_t *);
+entity_t 	*hash_search(HashTable *, Slice);
+entity_t 	*index_entity(EntityIndex *, uint32_t);
+int 		type_search(TypeTable *, Slice);
+
+void 		clear_list(Engine *, List *);
+void 		clear_tree(Forest *, Tree *, node *, bool);
+void 		clear_hash_table(Engine *, HashTable *);
+void 		clear_types(TypeTable *);
+void 		clear_indices(EntityIndex *);
+void 		clear_set(EntitySet *);
+
+list_t 		*list_insert(Engine *, List *, char *);
+node 		*rb_insert(Forest *, Tree *, entity_t *);
+entity_t 	*hash_insert(Engine *, HashTable *, Slice);
+unsigned int 	type_intern(TypeTable *, Slice);
+void 		index_acquire(EntityIndex *, entity_t *);
+bool 		set_insert(EntitySet *, uint32_t);
+uint32_t 	set_next(EntitySet *, uint32_t *);
+bool 		set_contains(EntitySet *, uint32_t);
+void 		set_reserve(EntitySet *, uint32_t, uint64_t);
+void 		order_insert(Engine *, entity_t *);
+void 		order_build(Engine *, entity_t **, unsigned long);
+
+void 		list_delete(Engine *, List *, list_t *);
+void 		clear_list_node(Engine *, list_t *);
+void 		rb_delete(Forest *, Tree *, node *);
+void 		hash_delete(Engine *, HashTable *, entity_t *);
+void 		index_release(EntityIndex *, entity_t *);
+bool 		set_remove(EntitySet *, uint32_t);
+void 		order_delete(Engine *, entity_t *);
+
+void 		add_relation(Forest *, entity_t *, entity_t *, list_t *);
+bool 		delete_relation(Forest *, entity_t *, entity_t *, list_t *);
+void 		hasrel(Engine *, Slice, Slice, Slice);
+void 		delete_entity_relations(Forest *, entity_t *, TypeSets *);
+void 		delete_shard_relations(Forest *, entity_t *, SetShard *);
+SetShard 	*entity_shard(Engine *, entity_t *, unsigned int);
+TypeSets 	*entity_sets(Engine *, entity_t *, unsigned int);
+TypeSets 	*entity_add_sets(Engine *, entity_t *, list_t *);
+void 		render_relation_tree(Forest *, node *, Buffer *);
+bool 		render_type(Engine *, list_t *);
+void 		report_diff(Engine *);
+void 		lower_data_maximum(list_t *);
+void 		restore_data_maximum(Engine *, list_t *);
+void 		move_degree(Forest *, list_t *, entity_t *, uint64_t, uint64_t);
+void 		remove_outgoing_relations(Forest *, EntitySet *, entity_t *, unsigned int);
+void 		remove_incoming_relations(Forest *, EntitySet *, entity_t *, list_t *);
+
+void 		process_input(Engine *, FILE *);
+
+bool 		run_engine(Options *, FILE *, int);
+void 		clear_engine(Engine *);
+void 		*replay_main(void *);
+int 		replay_files(Options *, char **, unsigned int, unsigned int);
+
+void 		init_workers(Engine *, unsigned int);
+void 		*worker_main(void *);
+void 		worker_submit(Worker *);
+void 		dispatch(Engine *, entity_t *, entity_t *, list_t *, TaskKind);
+void 		worker_append(Worker *, Task);
+void 		worker_wait(Worker *);
+void 		workers_wait(Engine *);
+void 		workers_barrier(Engine *);
+void 		clear_workers(Engine *);
+
+void 		init_output(Output *, int);
+void 		output_bytes(Output *, const char *, size_t);
+void 		output_number(Output *, uint64_t);
+void 		output_flush(Output *);
+void 		buffer_bytes(Buffer *, const char *, size_t);
+void 		buffer_number(Buffer *, uint64_t);
+
+void 		*pool_alloc(Pool *);
+void 		pool_free(Pool *, void *);
+void 		clear_pool(Pool *);
+void 		pool_merge(Pool *, Pool *);
+void 		print_pool(char *, Pool *);
+void 		print_hash_distribution(HashTable *);
+
+void 		checkpoint(Engine *, Slice);
+bool 		write_checkpoint(Engine *, const char *);
+bool 		load_checkpoint(Engine *, const char *);
+bool 		log_recover(Engine *, Options *);
+void 		log_command(Engine *, LogKind, Slice, Slice, Slice);
+void 		log_commit(CommandLog *);
+void 		log_compact(Engine *);
+void 		clear_log(CommandLog *);
+void 		tree_build(Forest *, Tree *, entity_t **, unsigned long);
+void 		grow_degrees(list_t *, uint64_t);
+void 		hash_reserve(HashTable *, unsigned long);
 
 /*--------------------------------------------*/
 
@@ -152,30 +639,113 @@ void 		print_string(char *);
  * MAIN
 
  * The main method of the program
+ *
+ * Options:
+ * -e <count>	expected number of entities, used to presize the hash table
+ * -s		prints the live and peak objects of every pool and the probes of the hash table on stderr at the end
+ * -t <threads>	executes 'addrel' and 'delrel' on the given number of worker threads
+ * -j <jobs>	number of input files replayed at the same time
+ * -l <file>	loads the graph saved by 'checkpoint' in the file before the input
+ * -w <file>	logs the commands changing the graph in the file, recovering the graph from it at startup
+ * -c <records>	number of logged commands after which the log is compacted into '<file>.ckp'
+ *
+ * Without input files the commands are read from stdin and the reports written to stdout,
+ * otherwise every file is replayed by its own engine and its reports are written to '<file>.out'
  */
-int main(void) {
-	//Initializes the NIL node
-	NIL = init_NIL();
-	//Initializes the Hash Table
-	ENTITIES = init_table();
-	//Initializes the head of the relation type list
-	RELATION_TYPES = init_list();
+int main(int argc, char *argv[]) {
+	Options 	options = { 0, 0, false, NULL, NULL, LOG_COMPACT_RECORDS };
+	unsigned int 	jobs = 1;
+	int 		option;
+
+	while ((option = getopt(argc, argv, "e:st:j:l:w:c:")) != -1) {
+		switch (option) {
+			case 'e':
+				options.expected_entities = strtoul(optarg, NULL, 10);
+				break;
+			case 's':
+				options.pool_statistics = true;
+				break;
+			case 't':
+				options.threads = strtoul(optarg, NULL, 10);
+				break;
+			case 'j':
+				jobs = strtoul(optarg, NULL, 10);
+				break;
+			case 'l':
+				options.checkpoint = optarg;
+				break;
+			case 'w':
+				options.log = optarg;
+				break;
+			case 'c':
+				options.compact_records = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-e expected_entities] [-s] [-t threads] [-j jobs] [-l checkpoint] [-w log [-c records]] [files...]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	//A log belongs to a single engine, and it recovers the graph by itself
+	if (options.log != NULL && (optind < argc || options.checkpoint != NULL)) {
+		fprintf(stderr, "%s: -w can't be used with -l or input files\n", argv[0]);
+		return 1;
+	}
+
+	//Initializes the key of the hash function, shared by all the engines
+	init_hash_seed();
+
+	if (optind < argc) {
+		return replay_files(&options, argv + optind, argc - optind, jobs);
+	}
 
 	//Processes all the input from stdin
-	process_input(stdin);
+	return run_engine(&options, stdin, STDOUT_FILENO) ? 0 : 1;
+}
+
+/*
+ * Given the options, an input and the file descriptor of the output,
+ * creates an engine, executes all the commands of the input and frees the engine
+ *
+ * Returns FALSE if the checkpoint or the log in the options could not be loaded, TRUE otherwise
+ */
+bool run_engine(Options *options, FILE *input, int fd) {
+	Engine 	*engine = init_engine(options, fd);
+	bool 	loaded;
+
+	if (options->log != NULL) {
+		loaded = log_recover(engine, options);
+	} else {
+		loaded = options->checkpoint == NULL || load_checkpoint(engine, options->checkpoint);
+	}
 
-	//When every command has been executed, frees all the memory
-	//Frees all the nodes of the 'RELATION_TYPES' list
-	clear_list(RELATION_TYPES);
-	free(RELATION_TYPES);
+	//The input is not executed on a partially loaded graph
+	if (loaded) process_input(engine, input);
 
-	//Frees all memory allocated for relations and Entries
-	clear_hash_table(ENTITIES);
-	free(ENTITIES);
+	//Waits for the last relation commands and stops the worker threads
+	clear_workers(engine);
+
+	//Writes the last logged commands
+	log_commit(&engine->log);
 
-	free(NIL);
+	//Writes what's left in the output buffer
+	output_flush(&engine->output);
 
-	return 0;
+	if (options->pool_statistics) {
+		flockfile(stderr);
+
+		print_pool("node", &engine->forest.node_pool);
+		print_pool("tree", &engine->forest.tree_pool);
+		print_pool("list", &engine->list_pool);
+		print_pool("entity", &engine->entity_pool);
+		print_hash_distribution(engine->entities);
+
+		funlockfile(stderr);
+	}
+
+	clear_engine(engine);
+
+	return loaded;
 }
 
 /************************/
@@ -188,11 +758,11 @@ int main(void) {
  * Searches if the given entity is already present in the hashtable,
  * if not, inserts it
  */
-void addent(char *ident) {
-	entity_t *search = hash_search(ENTITIES, ident);
+void addent(Engine *engine, Slice ident) {
+	entity_t *search = hash_search(engine->entities, ident);
 
 	if (search == NULL) {
-		hash_insert(ENTITIES, ident);
+		order_insert(engine, hash_insert(engine, engine->entities, ident));
 	}
 }
 
@@ -203,816 +773,2860 @@ void addent(char *ident) {
  * gets the Tree of the entity corresponding to 'to', and add a node with the entity_t
  * 'from'.
  *
- * After insertion adds a name to the report data tree or, if the current maximum value
- * is overridden, clears the data tree and inserts the current 'to' entity_t
+ * After insertion moves 'to' up by one in the report data of the type, overriding
+ * the current maximum if needed
  */
-void addrel(char *from, char *to, char *type) {
-	entity_t *from_entity = hash_search(ENTITIES, from);
-	entity_t *to_entity = hash_search(ENTITIES, to);
+void addrel(Engine *engine, Slice from, Slice to, Slice type) {
+	entity_t *from_entity = hash_search(engine->entities, from);
+	entity_t *to_entity = hash_search(engine->entities, to);
 
 	//Exits if one the entities is not found.
 	if (from_entity == NULL || to_entity == NULL) return;
 
+	//The id of the relation type, interned if it's the first time it's used
+	unsigned int type_id = type_intern(engine->types, type);
+
 	//The node of the list containing the current 'type' relation data
-	list_t *data_list = list_search(RELATION_TYPES, type);
+	list_t *data_list = engine->types->data[type_id];
 
 	//Gets the data_list or if not already present adds it to the list for reporting
 	if (data_list == NULL) {
-		data_list = list_insert(RELATION_TYPES, type);
+		data_list = list_insert(engine, engine->relation_types, engine->types->names[type_id]);
+		data_list->type_id = type_id;
+
+		engine->types->data[type_id] = data_list;
 	}
 
-	//The node of the 'to' Entry with the current relation type
-	list_t *rel_list = list_search(to_entity->rel_list, type);
+	entity_shard(engine, from_entity, type_id)->used = true;
+	entity_shard(engine, to_entity, type_id)->used = true;
 
-	//Gets the list node or adds it if not already present in the entity relation types
-	if (rel_list == NULL) {
-		rel_list = list_insert_unordered(to_entity->rel_list, type);
+	if (engine->workers_count > 0) {
+		dispatch(engine, from_entity, to_entity, data_list, ADD_RELATION);
+		return;
 	}
 
-	//Searches if the relation is already present, if not inserts it
-	if (tree_search(rel_list->tree->root, from_entity) == NIL) {
-		rb_insert(rel_list->tree, from_entity);
-	}
+	add_relation(&engine->forest, from_entity, to_entity, data_list);
+}
 
-	//If the number of relations that point to 'to' is equal to the current maximum of this type of relation,
-	//adds the entity to the report list
-	if (rel_list->tree->size == data_list->current_maximum) {
-		if (tree_search(data_list->tree->root, to_entity) == NIL) {
-			rb_insert(data_list->tree, to_entity);
-		}
-		//Overrides the data tree if the number of relations is greater than current maximum
-	} else if (rel_list->tree->size > data_list->current_maximum) {
-		clear_tree(data_list->tree, data_list->tree->root, true);
+/*
+ * Given the entities 'from' and 'to' and the data list of the relation type,
+ * adds the relation if not present and moves 'to' up by one in the report data
+ *
+ * Executed by the worker owning the type when there are worker threads
+ */
+void add_relation(Forest *forest, entity_t *from_entity, entity_t *to_entity, list_t *data_list) {
+	//The set of the 'to' Entry with the current relation type
+	EntitySet *rel_set = &entity_add_sets(forest->engine, to_entity, data_list)->in;
 
-		rb_insert(data_list->tree, to_entity);
-		data_list->current_maximum = rel_list->tree->size;
-	}
+	//Returns if the relation is already present
+	if (!set_insert(rel_set, from_entity->index)) return;
+
+	//The set of the 'from' Entry with the current relation type, storing the outgoing relations
+	set_insert(&entity_add_sets(forest->engine, from_entity, data_list)->out, to_entity->index);
+
+	//Moves 'to' up by one in the report data, the maximum is updated if overridden
+	move_degree(forest, data_list, to_entity, rel_set->count - 1, rel_set->count);
 }
 
 /*
  * DELREL command
  *
  * After checking if 'from' and 'to' entities exist, and if the relation does exist,
- * gets the Tree of the entity corresponding to 'to', and deletes the node
- * with the entity_t 'from'.
+ * gets the set of the entity corresponding to 'to', and removes
+ * the entity_t 'from' from it.
  *
- * After insertion adds a name to the report data tree or, if the current maximum value
- * is overridden, clears the data tree and inserts the current 'to' entity_t
+ * After deletion moves 'to' down by one in the report data of the type, lowering
+ * the current maximum if needed
  */
-void delrel(char *from, char *to, char *type) {
-	entity_t *from_entity = hash_search(ENTITIES, from);
-	entity_t *to_entity = hash_search(ENTITIES, to);
+void delrel(Engine *engine, Slice from, Slice to, Slice type) {
+	entity_t *from_entity = hash_search(engine->entities, from);
+	entity_t *to_entity = hash_search(engine->entities, to);
 
 	//Checks if any of the given entities does not exists
 	if (from_entity == NULL || to_entity == NULL) return;
 
-	//The data list with 'type'
-	list_t *data_list = list_search(RELATION_TYPES, type);
+	//The id of the relation type
+	int type_id = type_search(engine->types, type);
 
 	//Returns if 'type' of relation is not present globally
-	if (data_list == NULL) return;
+	if (type_id == -1 || engine->types->data[type_id] == NULL) return;
+
+	//The data list with 'type'
+	list_t *data_list = engine->types->data[type_id];
+
+	//Returns if the entity_t 'to' never had relations of the types of the shard
+	if (!entity_shard(engine, to_entity, type_id)->used) return;
+
+	if (engine->workers_count > 0) {
+		dispatch(engine, from_entity, to_entity, data_list, DELETE_RELATION);
+		return;
+	}
+
+	//Lowers the maximum if 'to' was the last entity with it
+	if (delete_relation(&engine->forest, from_entity, to_entity, data_list)) {
+		restore_data_maximum(engine, data_list);
+	}
+}
+
+/*
+ * Given the entities 'from' and 'to' and the data list of the relation type,
+ * deletes the relation and moves 'to' down by one in the report data
+ *
+ * Returns TRUE if the relation was present, FALSE otherwise.
+ * Executed by the worker owning the type when there are worker threads
+ */
+bool delete_relation(Forest *forest, entity_t *from_entity, entity_t *to_entity, list_t *data_list) {
+	unsigned int 	type_id = data_list->type_id;
+	TypeSets 	*to_sets = entity_sets(forest->engine, to_entity, type_id);
 
-	//Relation list of the entity_t 'to'
-	list_t *rel_list = list_search(to_entity->rel_list, type);
+	//Returns if 'to' never had relations of the type
+	if (to_sets == NULL) return false;
 
-	//Returns if 'type' of relation is not present in the entity_t
-	if (rel_list == NULL) return;
+	//Relation set of the entity_t 'to'
+	EntitySet *rel_set = &to_sets->in;
 
-	//The node to delete
-	node *to_delete = tree_search(rel_list->tree->root, from_entity);
+	//Returns if 'from' is not in the set (relation not present)
+	if (!set_remove(rel_set, from_entity->index)) return false;
 
-	//Returns if the node is not found (relation not present)
-	if (to_delete == NIL) return;
+	//Deletes the relation from the outgoing relations of 'from' as well
+	set_remove(&entity_sets(forest->engine, from_entity, type_id)->out, to_entity->index);
 
-	//Deletes the node
-	rb_delete(rel_list->tree, to_delete);
+	//Moves 'to' down by one in the report data
+	move_degree(forest, data_list, to_entity, rel_set->count + 1, rel_set->count);
 
-	//Checks if the data tree needs to be rewritten (meaning the current relation had 'size' equal to current maximum)
-	if (rel_list->tree->size + 1 == data_list->current_maximum) {
-		//Case there is more than one entity with the size equal to current maximum
-		//Only deletes the node from the data tree
-		if (data_list->tree->size > 1) {
-			rb_delete(data_list->tree, tree_search(data_list->tree->root, to_entity));
-			//Otherwise calls the function 'restore_data_maximum' that rewrites the data tree
-		} else {
-			restore_data_maximum(data_list, type);
+	return true;
+}
+
+/*
+ * HASREL command
+ *
+ * Prints "yes" if the relation of type 'type' from 'from' to 'to' is present, "no" otherwise.
+ * It's a single lookup of 'from' in the set of the incoming relations of 'to'
+ *
+ * With worker threads, only the owner of the type is waited for
+ */
+void hasrel(Engine *engine, Slice from, Slice to, Slice type) {
+	entity_t 	*from_entity = hash_search(engine->entities, from);
+	entity_t 	*to_entity = hash_search(engine->entities, to);
+	int 		type_id = type_search(engine->types, type);
+	TypeSets 	*to_sets;
+	bool 		present = false;
+
+	if (from_entity != NULL && to_entity != NULL && type_id != -1 && engine->types->data[type_id] != NULL && entity_shard(engine, to_entity, type_id)->used) {
+		if (engine->workers_count > 0) {
+			worker_wait(&engine->workers[type_id % engine->workers_count]);
 		}
+
+		to_sets = entity_sets(engine, to_entity, type_id);
+		present = to_sets != NULL && set_contains(&to_sets->in, from_entity->index);
+	}
+
+	if (present) {
+		output_bytes(&engine->output, "yes\n", 4);
+	} else {
+		output_bytes(&engine->output, "no\n", 3);
 	}
 }
 
 /*
  * DELENT command
  *
- * After checking if the given entities exist, deletes it
- * from the hashtable, then deletes all the relations it had
- * with other entities. Finally deletes the relations the other
- * entities had with the given entity.
+ * After checking if the given entities exist, deletes all the relations
+ * that have the entity as "to" and all the relations that have the entity as "from",
+ * visiting only the types the entity has relations of and the sets stored in the entity itself.
+ * Finally deletes the entity from the hashtable.
+ *
+ * Every relation type of the entity that loses all of its reported entities
+ * gets its maximum restored with 'restore_data_maximum'.
+ * With worker threads, every worker wipes the types of its SetShard, all at the same time
  */
-void delent(char *ident) {
-	entity_t 	*search = hash_search(ENTITIES, ident);
-	entity_t 	*ent_cursor;
+void delent(Engine *engine, Slice ident) {
+	entity_t 	*search = hash_search(engine->entities, ident);
 
-	node 		*deletion;
-	list_t 		*rel_cursor, *list, *next;
+	SetShard 	*shard;
+	list_t 		*data_list;
 
 	//Returns if entity is not present
 	if (search == NULL) return;
 
-	//Head of the list of the global relation types
-	rel_cursor = RELATION_TYPES->head;
-
-	while (rel_cursor != NULL) {
-		//Saves the next incase rel_cursor needs to be removed (no more relations with that type)
-		next = rel_cursor->next;
-
-		//Cicles the entities
-		for (int i = 0; i < HASH_DIMENSION; i++) {
-			ent_cursor = ENTITIES->table[i];
-
-			while (ent_cursor != NULL) {
-				//Gets the relation type
-				list = list_search(ent_cursor->rel_list, rel_cursor->key);
+	//Only the workers of the shards with types are handed a Task
+	for (unsigned int i = 0; i < engine->set_shards; i++) {
+		if (!search->shards[i].used) continue;
 
-				//If relation type list is not present skips to the next entity_t
-				if (list == NULL) {
-					ent_cursor = ent_cursor->next;
-					continue;
-				}
+		if (engine->workers_count > 0) {
+			worker_append(&engine->workers[i], (Task) { search, NULL, NULL, DELETE_ENTITY });
+		} else {
+			delete_shard_relations(&engine->forest, search, &search->shards[i]);
+		}
+	}
 
-				//If the entity_t is the one to be deleted, completely wipes the relations from the tree
-				if (ent_cursor == search) {
-					clear_tree(list->tree, list->tree->root, true);
+	workers_wait(engine);
 
-					if ((deletion = tree_search(rel_cursor->tree->root, ent_cursor)) != NIL) {
-						rb_delete(rel_cursor->tree, deletion);
-					}
-					//Otherwise searches if the relation with the entity to delete is present, and deletes it
-				} else if ((deletion = tree_search(list->tree->root, search)) != NIL) {
-					rb_delete(list->tree, deletion);
-				}
+	//Deletes the relation types left without relations, their maximum was only lowered
+	for (unsigned int i = 0; i < engine->set_shards; i++) {
+		shard = &search->shards[i];
 
-				ent_cursor = ent_cursor->next;
+		for (uint32_t j = 0; shard->used && j < shard->capacity; j++) {
+			if (shard->slots[j].type_id != SET_EMPTY && (data_list = engine->types->data[shard->slots[j].type_id]) != NULL) {
+				restore_data_maximum(engine, data_list);
 			}
 		}
-
-		//Restores the correct data tree information
-		restore_data_maximum(rel_cursor, rel_cursor->key);
-
-		rel_cursor = next;
 	}
 
 	//Finally, deletes the entity_t
-	hash_delete(ENTITIES, ident);
+	order_delete(engine, search);
+	hash_delete(engine, engine->entities, search);
 }
 
 /*
- * REPORT command
+ * Given an entity_t and one of its SetShard,
+ * deletes the relations of every type of the shard the entity still has relations of,
+ * lowering the maximum of the type
  *
- * Simply prints out the information stored by the other commands in the 'RELATION_TYPES' list
- *
- * Uses fputs since it's faster than printf when formatting is not necessary
+ * Executed by the worker owning the types of the shard when there are worker threads
  */
-void report(void) {
-	list_t *rel_cursor = RELATION_TYPES->head;
-
-	//If nothing has to be printed, prints out none
-	if (rel_cursor == NULL) {
-		fputs_unlocked("none", stdout);
-	} else {
-		while (rel_cursor != NULL) {
-			//Prints relation type
-			print_string(rel_cursor->key);
+void delete_shard_relations(Forest *forest, entity_t *search, SetShard *shard) {
+	TypeSets *sets;
 
-			//Prints all the entities
-			print_relation_tree(rel_cursor->tree->root);
+	for (uint32_t i = 0; i < shard->capacity; i++) {
+		sets = &shard->slots[i];
 
-			//Prints the value maximum
-			printf("%d; ", rel_cursor->current_maximum);
+		//Empty slots have empty sets
+		if (sets->in.count == 0 && sets->out.count == 0) continue;
 
-			rel_cursor = rel_cursor->next;
-		}
+		delete_entity_relations(forest, search, sets);
+		lower_data_maximum(sets->data_list);
 	}
-
-	fputc_unlocked('\n', stdout);
 }
 
 /*
- * Given a data list and a 'type',
- * Checks all the entities to get the new maximum
+ * Given an entity_t and its TypeSets of a relation type,
+ * deletes all the relations of that type that have the entity as "to" or as "from"
  *
- * Used to restore the data tree for 'report',
+ * Only touches the sets of the type, so it's executed by the worker owning the type
+ * when there are worker threads
  */
-void restore_data_maximum(list_t *data_list, char *type) {
-	list_t 		*rel_list;
-	entity_t 	*ent_cursor;
+void delete_entity_relations(Forest *forest, entity_t *search, TypeSets *sets) {
+	EntitySet 	*rel_set;
 
-	//Re-initializes the current maximum to 0
-	data_list->current_maximum = 0;
+	//Wipes the relations that have the entity as "to"
+	rel_set = &sets->in;
 
-	//Cicles all the entities in the hashtable
-	for (int i = 0; i < HASH_DIMENSION; i++) {
-		ent_cursor = ENTITIES->table[i];
+	if (rel_set->count > 0) {
+		//Removes the entity from the report data
+		move_degree(forest, sets->data_list, search, rel_set->count, 0);
 
-		while (ent_cursor != NULL) {
-			//entity_t 'type' relation list
-			rel_list = list_search(ent_cursor->rel_list, type);
+		//Removes the relations from the outgoing sets of the other entities
+		remove_outgoing_relations(forest, rel_set, search, sets->data_list->type_id);
+	}
 
-			if (rel_list != NULL) {
-				//Case size is equal to maximum, only adds a node to the data list
-				if (rel_list->tree->size > 0 && rel_list->tree->size == data_list->current_maximum) {
-					rb_insert(data_list->tree, ent_cursor);
-					//Case size is greater than maximum, clears the data tree, and inserts first node
-				} else if (rel_list->tree->size > data_list->current_maximum) {
-					clear_tree(data_list->tree, data_list->tree->root, true);
+	clear_set(rel_set);
 
-					//Sets the new maximum
-					data_list->current_maximum = rel_list->tree->size;
-					rb_insert(data_list->tree, ent_cursor);
-				}
-			}
+	//Wipes the relations that have the entity as "from"
+	rel_set = &sets->out;
 
-			//Next element if collisions in hashtable are present
-			ent_cursor = ent_cursor->next;
-		}
+	if (rel_set->count > 0) {
+		remove_incoming_relations(forest, rel_set, search, sets->data_list);
 	}
 
-	//If no relations are found at all, deletes the data tree and the relation type
-	if (data_list->current_maximum == 0) {
-		clear_tree(data_list->tree, data_list->tree->root, true);
-		list_delete(RELATION_TYPES, type);
-	}
+	clear_set(rel_set);
 }
 
-/****************************/
-/*	INPUT FUNCTIONS     */
-/****************************/
-
 /*
- * Given four arguments, checks the 'command' parameter and calls
- * the right command
+ * Given the incoming relations set of an entity_t 'to' and their type id,
+ * deletes 'to' from the outgoing relations set of every entity in the set
  *
- * Returns -1 if 'end' is called or a not recognised command is found
-*/
-int process_arguments(char *command, char *arg1, char *arg2, char *arg3) {
-	if (strcmp(command, "addent") == 0) {
-		addent(arg1);
-		return 0;
-	} else if (strcmp(command, "delent") == 0) {
-		delent(arg1);
-		return 1;
-	} else if (strcmp(command, "addrel") == 0) {
-		addrel(arg1, arg2, arg3);
-		return 2;
-	} else if (strcmp(command, "delrel") == 0) {
-		delrel(arg1, arg2, arg3);
-		return 3;
-	} else if (strcmp(command, "report") == 0) {
-		report();
-		return 4;
-	} else if (strcmp(command, "end") == 0) {
-		return -1;
-	} else {
-		return -1;
+ * Used in 'delent'
+ */
+void remove_outgoing_relations(Forest *forest, EntitySet *rel_set, entity_t *to, unsigned int type_id) {
+	entity_t 	*from;
+	uint32_t 	cursor = 0, index;
+
+	while ((index = set_next(rel_set, &cursor)) != SET_EMPTY) {
+		from = index_entity(&forest->engine->indices, index);
+		set_remove(&entity_sets(forest->engine, from, type_id)->out, to->index);
 	}
 }
 
 /*
- * Gets stdin input until 'end' command is encountered
+ * Given the outgoing relations set of an entity_t 'from' and the data list of their type,
+ * deletes 'from' from the incoming relations set of every entity in the set
+ *
+ * Every entity is moved down by one in the report data
+ *
+ * Used in 'delent'
  */
-void process_input(FILE *input) {
-	//Arguments
-	char 		arguments[4][100], current_char;
+void remove_incoming_relations(Forest *forest, EntitySet *rel_set, entity_t *from, list_t *data_list) {
+	EntitySet 	*in_set;
+	entity_t 	*to;
+	uint32_t 	cursor = 0, index;
+
+	while ((index = set_next(rel_set, &cursor)) != SET_EMPTY) {
+		to = index_entity(&forest->engine->indices, index);
+		in_set = &entity_sets(forest->engine, to, data_list->type_id)->in;
+
+		//Already removed if the relation is from the entity to itself
+		if (!set_remove(in_set, from->index)) continue;
+
+		move_degree(forest, data_list, to, in_set->count + 1, in_set->count);
+	}
+}
 
-	//Counters
-	int 		char_count = 0, arg_count = 0, code;
+/*
+ * REPORT command
+ *
+ * Prints out the information stored by the other commands in the 'relation_types' list
+ *
+ * The line is rendered again only if something changed since the previous 'report',
+ * and only the relation types marked as dirty are rendered again
+ */
+void report(Engine *engine) {
+	list_t *rel_cursor;
 
-	while ((current_char = getc_unlocked(input)) != EOF) {
-		//When a space or a new line is found, needs to allocate another argument`
-		//If new line is read, processes the command
-		if (current_char == ' ' || current_char == '\n') {
+	workers_barrier(engine);
 
-			//Sets the end of the string
-			arguments[arg_count][char_count] = '\0';
+	rel_cursor = engine->relation_types->head;
 
-			//Increments 'arg_count' since the previous one has been allocated
-			arg_count++;
+	if (engine->report_dirty) {
+		engine->report.length = 0;
 
-			//Calls the process function if new line is found
-			if (current_char == '\n') {
-				code = process_arguments(arguments[0], arguments[1], arguments[2], arguments[3]);
+		//If nothing has to be printed, prints out none
+		if (rel_cursor == NULL) {
+			buffer_bytes(&engine->report, "none", 4);
+		}
 
-				//Exits if end is found
-				if (code == -1) return;
+		//Forgets the rendering of the removed types, they are left out of the line
+		for (unsigned int id = 0; id < engine->types->count; id++) {
+			if (engine->types->data[id] == NULL) engine->types->rendered[id].length = 0;
+		}
 
-				arg_count = 0;
+		while (rel_cursor != NULL) {
+			if (rel_cursor->dirty) {
+				render_type(engine, rel_cursor);
 			}
 
-			//Restores the initial counter for the buffer
-			char_count = 0;
-		} else if (current_char != '\"') { //Otherwise stores the characters in the buffer string
-			arguments[arg_count][char_count] = current_char;
+			buffer_bytes(&engine->report, engine->types->rendered[rel_cursor->type_id].bytes, engine->types->rendered[rel_cursor->type_id].length);
 
-			char_count++;
+			rel_cursor = rel_cursor->next;
 		}
+
+		buffer_bytes(&engine->report, "\n", 1);
+		engine->report_dirty = false;
 	}
-}
 
-/****************************/
-/*	LIST FUNCTIONS	    */
-/****************************/
+	output_bytes(&engine->output, engine->report.bytes, engine->report.length);
+}
 
 /*
- * Inizializes a new list
+ * REPORTDIFF command
+ *
+ * Prints out only the relation types whose entities or maximum changed since the
+ * previous 'report' or 'reportdiff', in the same format of 'report', followed by the
+ * relation types that lost all their relations as "type" none;
+ *
+ * If nothing changed, prints out an empty line
  */
-List *init_list(void) {
-	List *list = malloc(sizeof(List));
-	list->head = NULL;
+void report_diff(Engine *engine) {
+	list_t *rel_cursor;
 
-	return list;
-}
+	workers_barrier(engine);
 
-/*
- * Given a list and a string 'key',
- * returns the list node with the given 'key', NULL otherwise
- */
-inline list_t *list_search(List *list, char *key) {
-	list_t *cursor = list->head;
+	rel_cursor = engine->relation_types->head;
 
-	//Exits when found or NULL
-	while (cursor != NULL && strcmp(cursor->key, key) != 0) {
-		cursor = cursor->next;
+	while (rel_cursor != NULL) {
+		if (rel_cursor->dirty && render_type(engine, rel_cursor)) {
+			output_bytes(&engine->output, engine->types->rendered[rel_cursor->type_id].bytes, engine->types->rendered[rel_cursor->type_id].length);
+		}
+
+		rel_cursor = rel_cursor->next;
 	}
 
-	return cursor;
-}
+	//Types with a rendering but no relations were printed before and have been removed since
+	for (unsigned int id = 0; id < engine->types->count; id++) {
+		if (engine->types->data[id] == NULL && engine->types->rendered[id].length > 0) {
+			output_bytes(&engine->output, "\"", 1);
+			output_bytes(&engine->output, engine->types->names[id], strlen(engine->types->names[id]));
+			output_bytes(&engine->output, "\" none; ", 8);
 
-list_t *list_insert_unordered(List *list, char *key) {
-	//Creates and initializes the node
-	list_t 		*new = malloc(sizeof(list_t));
-	list_t 		*cursor, *prev;
-
-	new->key = strdup(key);
-	new->tree = init_tree();
-	new->current_maximum = 0;
-	new->next = list->head;
-
-	list->head = new;
+			engine->types->rendered[id].length = 0;
+		}
+	}
 
-	return new;
+	output_bytes(&engine->output, "\n", 1);
 }
 
 /*
- * Given a list and a string 'key'
- * inserts the node in the list in alphabetic order
+ * Given a data list,
+ * renders its part of the 'report': the relation type, the entities with the maximum and the maximum
  *
- * Does not check if the given 'key' is already present,
- * so 'list_search' needs to be called first
+ * IDs are copied as they are already stored between double quotes.
+ * The type is rendered in 'render_scratch', then swapped with its rendering in 'types',
+ * returns TRUE if the rendering is different from the previous one, FALSE otherwise.
+ * The previous rendering survives the deletion of the type, so a type deleted and added
+ * again with the same entities is not reported as changed
  */
-list_t *list_insert(List *list, char *key) {
-	//Creates and initializes the node
-	list_t 		*new = malloc(sizeof(list_t));
-	list_t 		*cursor, *prev;
+bool render_type(Engine *engine, list_t *data_list) {
+	Buffer 	*rendered = &engine->render_scratch, previous;
+	bool 	changed;
 
-	new->key = strdup(key);
-	new->tree = init_tree();
-	new->current_maximum = 0;
+	rendered->length = 0;
 
-	prev = NULL;
-	cursor = list->head;
+	//Relation type
+	buffer_bytes(rendered, "\"", 1);
+	buffer_bytes(rendered, data_list->key, strlen(data_list->key));
+	buffer_bytes(rendered, "\" ", 2);
 
-	//Exits when found position or out of the list (tail insertion)
-	while (cursor != NULL && strcmp(cursor->key, key) < 0) {
-		prev = cursor;
-		cursor = cursor->next;
-	}
+	//All the entities
+	render_relation_tree(&engine->forest, data_list->degrees[data_list->current_maximum]->root, rendered);
 
-	if (prev == NULL) {//If the element is to be put as the new head
-		new->next = list->head;
-		list->head = new;
-	} else {
-		//Node linking
-		prev->next = new;
-		new->next = cursor;
-	}
+	//The value maximum
+	buffer_number(rendered, data_list->current_maximum);
+	buffer_bytes(rendered, "; ", 2);
 
-	return new;
+	previous = engine->types->rendered[data_list->type_id];
+	changed = previous.length != rendered->length || memcmp(previous.bytes, rendered->bytes, rendered->length) != 0;
+
+	engine->types->rendered[data_list->type_id] = *rendered;
+	engine->render_scratch = previous;
+
+	data_list->dirty = false;
+
+	return changed;
 }
 
 /*
- * Given a list and a string 'key'
- * deletes the list node with the given 'key'
- *
- * Needs to be checked beforehand if the 'key' is present in the list
- * with 'list_search'
+ * Given a data list,
+ * marks its rendered 'report' as to be rendered again
  */
-void list_delete(List *list, char *key) {
-	list_t *cursor, *prev, *temp, *todelete;
+static inline void mark_dirty(Engine *engine, list_t *data_list) {
+	data_list->dirty = true;
 
-	if (list->head != NULL && strcmp(list->head->key, key) == 0) {
-		//Sets the head of the list to the second element
-		temp = list->head;
-		list->head = list->head->next;
+	//Written by every worker, all of them write TRUE
+	__atomic_store_n(&engine->report_dirty, true, __ATOMIC_RELAXED);
+}
 
-		todelete = temp;
-	} else {
-		prev = list->head;
-		cursor = list->head->next;
+/*
+ * Given a data list,
+ * lowers the current maximum until a tree in 'degrees' with at least one entity is found
+ */
+void lower_data_maximum(list_t *data_list) {
+	while (data_list->current_maximum > 0 && (data_list->degrees[data_list->current_maximum] == NULL || data_list->degrees[data_list->current_maximum]->size == 0)) {
+		data_list->current_maximum--;
+	}
+}
 
-		while (cursor != NULL && strcmp(cursor->key, key) != 0) {
-			prev = cursor;
-			cursor = cursor->next;
-		}
+/*
+ * Given a data list,
+ * lowers the current maximum with 'lower_data_maximum'
+ *
+ * Used to restore the data for 'report' after relations are deleted,
+ * if no relations are left at all, deletes the relation type.
+ * The workers only lower the maximum, the types are deleted by the main thread in 'delent' or 'workers_barrier'
+ */
+void restore_data_maximum(Engine *engine, list_t *data_list) {
+	lower_data_maximum(data_list);
 
-		//cursor is now the element to delete
-		prev->next = cursor->next;
+	//If no relations are found at all, deletes the relation type
+	if (data_list->current_maximum == 0) {
+		engine->types->data[data_list->type_id] = NULL;
+		list_delete(engine, engine->relation_types, data_list);
 
-		todelete = cursor;
+		engine->report_dirty = true;
 	}
-
-	//Frees all allocated memory
-	clear_tree(todelete->tree, todelete->tree->root, true);
-	free(todelete->key);
-	free(todelete->tree);
-	free(todelete);
 }
 
 /*
- * Given a list,
- * deletes all nodes and frees the memory
+ * Given a data list, an entity_t and its old and new number of incoming relations,
+ * moves the entity_t from the 'degrees' tree of the old number to the one of the new number
+ *
+ * Entities without incoming relations (number equal to 0) are not stored,
+ * raises the current maximum if the new number overrides it
  */
-void clear_list(List *list) {
-	list_t *cursor = list->head, *temp;
+void move_degree(Forest *forest, list_t *data_list, entity_t *ent, uint64_t old_degree, uint64_t new_degree) {
+	Tree *old_tree;
 
-	while (cursor != NULL) {
-		//Gets the element to delete and goes further by one element
-		temp = cursor;
-		cursor = cursor->next;
+	//The reported entities change if the entity leaves or reaches the maximum
+	if (old_degree == data_list->current_maximum || new_degree >= data_list->current_maximum) {
+		mark_dirty(forest->engine, data_list);
+	}
 
-		//Frees all allocated memory
-		clear_tree(temp->tree, temp->tree->root, true);
-		free(temp->key);
-		free(temp->tree);
-		free(temp);
+	if (old_degree > 0) {
+		old_tree = data_list->degrees[old_degree];
+		rb_delete(forest, old_tree, tree_search(forest, old_tree->root, ent));
+	}
+
+	if (new_degree == 0) return;
+
+	grow_degrees(data_list, new_degree);
+
+	if (data_list->degrees[new_degree] == NULL) {
+		data_list->degrees[new_degree] = init_tree(forest);
+	}
+
+	rb_insert(forest, data_list->degrees[new_degree], ent);
+
+	if (new_degree > data_list->current_maximum) {
+		data_list->current_maximum = new_degree;
 	}
 }
 
 /*
- * Prints the given list
- *
- * Only used for debugging
+ * Given a data list and a number of incoming relations,
+ * doubles the array of trees in 'degrees' until it covers that number, the new trees are not allocated yet
  */
-void print_list(List *list) {
-	printf("\ndebug list:\n");
-	list_t *cursor = list->head;
+void grow_degrees(list_t *data_list, uint64_t degree) {
+	uint64_t size = data_list->degrees_size;
 
-	while (cursor != NULL) {
-		printf("%s\t", cursor->key);
+	if (degree < size) return;
 
-		cursor = cursor->next;
+	while (degree >= size) size *= 2;
+
+	data_list->degrees = realloc(data_list->degrees, size * sizeof(Tree *));
+
+	for (uint64_t i = data_list->degrees_size; i < size; i++) {
+		data_list->degrees[i] = NULL;
 	}
-	printf("\n\n");
+
+	data_list->degrees_size = size;
 }
 
-/********************************/
-/*		HASH TABLE FUNCTIONS	*/
-/********************************/
+/****************************/
+/*	INPUT FUNCTIONS     */
+/****************************/
 
 /*
- * Creates and returns an HashTable
+ * Given a slice and a string, returns TRUE if they contain the same characters
  */
-HashTable *init_table(void) {
-	HashTable *ht = malloc(sizeof(HashTable));
-	ht->table = calloc(HASH_DIMENSION, sizeof(entity_t)); //Sets every cell to NULL
-	return ht;
+static inline bool slice_equals(Slice slice, const char *string) {
+	return strncmp(slice.start, string, slice.length) == 0 && string[slice.length] == '\0';
 }
 
 /*
- * Given a character shifts and returns its value in a range from '1' to '54'
+ * Given four arguments, checks the 'command' parameter and calls
+ * the right command
  *
- * Used as util in the 'hash_string' function
- */
-int shift_char_value(char c) {
-	if (c == 45) return 1; //The '-' char
-	if (c == 95) return 2; //The '_' char
-
-	if (c >= 65 /*A*/ && c <= 90 /*Z*/) return c - 62; //uppercase letters
-	if (c >= 97 /*a*/ && c <= 122 /*z*/) return c - 68; //lowercase letters
-
-	return c;
+ * Returns -1 if 'end' is called or a not recognised command is found
+*/
+int process_arguments(Engine *engine, Slice command, Slice arg1, Slice arg2, Slice arg3) {
+	if (slice_equals(command, "addent")) {
+		log_command(engine, LOG_ADDENT, arg1, arg2, arg3);
+		addent(engine, arg1);
+		return 0;
+	} else if (slice_equals(command, "delent")) {
+		log_command(engine, LOG_DELENT, arg1, arg2, arg3);
+		delent(engine, arg1);
+		return 1;
+	} else if (slice_equals(command, "addrel")) {
+		log_command(engine, LOG_ADDREL, arg1, arg2, arg3);
+		addrel(engine, arg1, arg2, arg3);
+		return 2;
+	} else if (slice_equals(command, "delrel")) {
+		log_command(engine, LOG_DELREL, arg1, arg2, arg3);
+		delrel(engine, arg1, arg2, arg3);
+		return 3;
+	} else if (slice_equals(command, "report")) {
+		report(engine);
+		return 4;
+	} else if (slice_equals(command, "reportdiff")) {
+		report_diff(engine);
+		return 5;
+	} else if (slice_equals(command, "checkpoint")) {
+		checkpoint(engine, arg1);
+		return 6;
+	} else if (slice_equals(command, "hasrel")) {
+		hasrel(engine, arg1, arg2, arg3);
+		return 7;
+	} else if (slice_equals(command, "end")) {
+		return -1;
+	} else {
+		return -1;
+	}
 }
 
+#if defined(__AVX2__) && !defined(TOKENIZER_SCALAR)
+
 /*
- * Given a string
- * returns the index where to put the string into the hashtable,
- * given the hash dimension as a constant
- *
- * Gets the current char value, multipling it by the index of the character, squared
+ * Given TOKEN_BLOCK bytes of input,
+ * returns a mask with the bits of the spaces and new line characters set
  */
-int hash_string(char *to_hash) {
-	int 		length = strlen(to_hash);
-	long int 	hash = 0;
+static inline uint64_t separators_mask(const char *block) {
+	__m256i 	spaces = _mm256_set1_epi8(' '), new_lines = _mm256_set1_epi8('\n');
+	__m256i 	low = _mm256_loadu_si256((const __m256i *) block);
+	__m256i 	high = _mm256_loadu_si256((const __m256i *) (block + 32));
 
-	//Sums the characters value multiplied by their position in the string
-	for (int i = 0; i < length; i++) {
-		hash += i * i * shift_char_value(to_hash[i]);
-	}
+	uint32_t 	low_mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(low, spaces), _mm256_cmpeq_epi8(low, new_lines)));
+	uint32_t 	high_mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(high, spaces), _mm256_cmpeq_epi8(high, new_lines)));
 
-	return hash % HASH_DIMENSION; //Returns an index from '0' to 'HASH_DIMENSION -1'
+	return (uint64_t) low_mask | ((uint64_t) high_mask << 32);
 }
 
-/*
- * Prints the global HashTable
- *
- * Only used for debugging
- */
-void print_hash(HashTable *ht) {
-	entity_t *current, *cursor;
+#elif defined(__SSE2__) && !defined(TOKENIZER_SCALAR)
 
-	for (int i = 0; i < HASH_DIMENSION; i++) {
-		current = ht->table[i];
-		if (current == NULL) continue;
+static inline uint64_t separators_mask(const char *block) {
+	__m128i 	spaces = _mm_set1_epi8(' '), new_lines = _mm_set1_epi8('\n'), chunk;
+	uint64_t 	mask = 0;
 
-		printf("%d: \t\t", i);
+	for (int i = 0; i < 4; i++) {
+		chunk = _mm_loadu_si128((const __m128i *) (block + i * 16));
 
-		cursor = current;
-		while (cursor != NULL) {
-			printf("%s\t", cursor->id);
-			cursor = cursor->next;
-		}
+		mask |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, spaces), _mm_cmpeq_epi8(chunk, new_lines))) << (i * 16);
+	}
+
+	return mask;
+}
+
+#else
 
-		printf("\n");
+static inline uint64_t separators_mask(const char *block) {
+	uint64_t mask = 0;
+
+	for (int i = 0; i < TOKEN_BLOCK; i++) {
+		if (block[i] == ' ' || block[i] == '\n') mask |= 1ull << i;
 	}
+
+	return mask;
 }
 
+#endif
+
 /*
- * Given a string,
- * creates a new entity_t, and puts it into the global HashTable
- * returns the index
+ * Given a buffer with the input from 'start' to 'end',
+ * processes every complete line (ended by a new line character)
+ *
+ * The buffer is scanned TOKEN_BLOCK bytes at a time for spaces and new lines, that delimit the
+ * arguments: every argument becomes a slice of the buffer, without the double quotes around it.
+ * Only the quotes at the ends of an argument are dropped, the ones inside are kept as part of the ID
+ * (the parser before this one dropped every double quote of a token, the IDs of the specification have none).
+ * A new line processes the command with the arguments found since the previous one (at most four)
+ *
+ * Returns a pointer to the first character not processed, sets 'ended' if 'end' command is found
  */
-int hash_insert(HashTable *ht, char *to_hash) {
-	//Gets the hashtable index and the head of the collision list
-	int 		index = hash_string(to_hash);
-	entity_t 	*head = ht->table[index];
+char *process_lines(Engine *engine, char *start, char *end, bool *ended) {
+	Slice 		arguments[4];
+	int 		arg_count = 0, code;
+	char 		*line = start, *token = start, *block, *separator;
+	uint64_t 	mask;
+
+	for (block = start; block < end; block += TOKEN_BLOCK) {
+		//The last block is scanned one byte at a time, so nothing is read after 'end'
+		if (end - block >= TOKEN_BLOCK) {
+			mask = separators_mask(block);
+		} else {
+			mask = 0;
 
-	//Allocs memory for the new node and initializes the variables
-	entity_t 	*new = malloc(sizeof(entity_t));
+			for (int i = 0; i < end - block; i++) {
+				if (block[i] == ' ' || block[i] == '\n') mask |= 1ull << i;
+			}
+		}
 
-	new->id = strdup(to_hash);
-	new->rel_list = init_list();
-	new->next = head; //Links head to 'next'
+		while (mask != 0) {
+			separator = block + __builtin_ctzll(mask);
+			mask &= mask - 1;
 
-	//Head insertion
-	ht->table[index] = new;
+			if (arg_count < 4) {
+				//Skips the opening and closing double quotes
+				if (token < separator && *token == '\"') token++;
 
-	return index;
-}
+				arguments[arg_count].start = token;
+				arguments[arg_count].length = separator - token;
 
-/*
- * Given a string
- * returns the corresponding entity_t from the global HashTable, NULL if not present
- */
-entity_t *hash_search(HashTable *ht, char *to_hash) {
-	//Gets the index where the entity_t should be
-	int 		index = hash_string(to_hash);
+				if (separator > token && separator[-1] == '\"') arguments[arg_count].length--;
+
+				arg_count++;
+			}
 
-	entity_t 	*head = ht->table[index];
-	entity_t	*cursor = head;
+			token = separator + 1;
 
-	//Cicles the 'collisions list'
-	while (cursor != NULL && strcmp(cursor->id, to_hash) != 0) {
-		cursor = cursor->next;
+			if (*separator == '\n') {
+				//Arguments missing from the line are empty
+				for (; arg_count < 4; arg_count++) {
+					arguments[arg_count].start = token;
+					arguments[arg_count].length = 0;
+				}
+
+				code = process_arguments(engine, arguments[0], arguments[1], arguments[2], arguments[3]);
+
+				line = token;
+				arg_count = 0;
+
+				if (code == -1) {
+					*ended = true;
+					return line;
+				}
+			}
+		}
 	}
 
-	//At this point the cursor value is either the searched entity_t or NULL
-	return cursor;
+	return line;
 }
 
 /*
- * Given a string,
- * deletes the entity_t corresponding to that string
+ * Gets input until 'end' command is encountered
  *
- * returns the index where the entity_t was
- *
- * Needs to be checked beforehand with 'hash_search' if the entity_t is effectively present
+ * If the input is a regular file, it is mapped in memory and processed in place,
+ * otherwise it is read INPUT_BLOCK bytes at a time in a buffer (growing if a line does not fit).
+ * The logged commands are written before a 'read' that would wait, so they don't wait for the next input
  */
-int hash_delete(HashTable *ht, char *to_hash) {
-	//Index of the line where the node should be
-	int 		index = hash_string(to_hash);
+void process_input(Engine *engine, FILE *input) {
+	int 		fd = fileno(input);
+	struct stat 	info;
 
-	entity_t 	*head = ht->table[index], *todelete;
-	entity_t 	*cursor, *prev;
+	char 		*buffer, *rest;
+	size_t 		capacity = INPUT_BLOCK, filled = 0;
+	ssize_t 	bytes;
+	bool 		ended = false;
+	struct pollfd 	ready = { fd, POLLIN, 0 };
 
-	//if the list empty (not actually possible since used after 'hash_search')
-	if (head == NULL) return -1;
+	if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+		buffer = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
 
-	//if the head is the element to remove
-	if (head != NULL && strcmp(head->id, to_hash) == 0) {
-		ht->table[index] = head->next;
+		if (buffer != MAP_FAILED) {
+			madvise(buffer, info.st_size, MADV_SEQUENTIAL);
 
-		todelete = head;
-	} else {
-		//Cicles the list and stops when found or NULL
-		cursor = head->next;
-		prev = head;
+			process_lines(engine, buffer, buffer + info.st_size, &ended);
+
+			munmap(buffer, info.st_size);
+			return;
+		}
+	}
+
+	buffer = malloc(capacity);
 
-		while (cursor != NULL && strcmp(cursor->id, to_hash) != 0) {
-			prev = cursor;
-			cursor = cursor->next;
+	while (!ended && (bytes = read(fd, buffer + filled, capacity - filled)) != 0) {
+		if (bytes < 0) {
+			//Interrupted by a signal, reads again
+			if (errno == EINTR) continue;
+			break;
 		}
 
-		if (cursor == NULL) return -1;
+		filled += bytes;
+		rest = process_lines(engine, buffer, buffer + filled, &ended);
 
-		//Links the nodes
-		prev->next = cursor->next;
+		//Moves the incomplete line at the start of the buffer
+		filled = buffer + filled - rest;
+		memmove(buffer, rest, filled);
 
-		todelete = cursor;
-	}
+		//Doubles the buffer if a single line fills it
+		if (filled == capacity) {
+			capacity *= 2;
+			buffer = realloc(buffer, capacity);
+		}
 
-	//Frees all memory
-	clear_list(todelete->rel_list);
-	free(todelete->rel_list);
-	free(todelete->id);
-	free(todelete);
+		//The block has been processed, commits the log if the next 'read' would wait for the input
+		if (!ended && engine->log.fd != -1 && poll(&ready, 1, 0) == 0) log_commit(&engine->log);
+	}
 
-	return index;
+	free(buffer);
 }
 
+/****************************/
+/*	OUTPUT FUNCTIONS    */
+/****************************/
+
 /*
- * Iteratively frees every memory allocated in the hash table entries
+ * Given an Output and a file descriptor,
+ * allocates the buffer of the Output
  */
-void clear_hash_table(HashTable *ht) {
-	entity_t *cursor, *temp;
+void init_output(Output *output, int fd) {
+	output->buffer = malloc(OUTPUT_BUFFER);
+	output->used = 0;
+	output->fd = fd;
+}
 
-	for (int i = 0; i < HASH_DIMENSION; i++) {
-		cursor = ht->table[i];
+/*
+ * Given an Output,
+ * writes all the buffered bytes to its file descriptor
+ */
+void output_flush(Output *output) {
+	size_t 	written = 0;
+	ssize_t bytes;
 
-		while (cursor != NULL) {
-			temp = cursor;
-			cursor = cursor->next;
+	while (written < output->used) {
+		bytes = write(output->fd, output->buffer + written, output->used - written);
 
-			clear_list(temp->rel_list);
-			free(temp->rel_list);
-			free(temp->id);
-			free(temp);
+		if (bytes < 0) {
+			//Interrupted by a signal, writes again
+			if (errno == EINTR) continue;
+			break;
 		}
+
+		written += bytes;
 	}
+
+	output->used = 0;
 }
 
-/************************/
-/*		RB FUNCTIONS	*/
-/************************/
+/*
+ * Given an Output, some bytes and their number,
+ * copies the bytes in the buffer, flushing it first if there is not enough space
+ */
+void output_bytes(Output *output, const char *bytes, size_t length) {
+	if (output->used + length > OUTPUT_BUFFER) {
+		output_flush(output);
+
+		//Never happens with IDs, but bytes that don't fit in the whole buffer are copied in parts
+		while (length > OUTPUT_BUFFER) {
+			memcpy(output->buffer, bytes, OUTPUT_BUFFER);
+			output->used = OUTPUT_BUFFER;
+			output_flush(output);
+
+			bytes += OUTPUT_BUFFER;
+			length -= OUTPUT_BUFFER;
+		}
+	}
+
+	memcpy(output->buffer + output->used, bytes, length);
+	output->used += length;
+}
 
 /*
- * Given an entity_t,
- * allocates memory for a new node and returns it
+ * Given an array of 20 characters and a number,
+ * writes the decimal digits of the number at the end of the array, returns the index of the first one
  */
-node *init_node(entity_t *to) {
-	node *z = malloc(sizeof(node));
+static inline int format_number(char *digits, uint64_t number) {
+	int first = 20;
 
-	//inserts arguments
-	z->to = to;
-	z->left = NIL;
-	z->right = NIL;
-	z->color = RED;
+	//Writes the digits from the last one
+	do {
+		digits[--first] = '0' + number % 10;
+		number /= 10;
+	} while (number > 0);
 
-	return z;
+	return first;
 }
 
 /*
- * Util function to initialize the NIL node
+ * Given an Output and a number,
+ * copies the decimal digits of the number in the buffer
  */
-node *init_NIL(void) {
-	node *new = malloc(sizeof(node));
-	new->p = new;
-	new->right = NIL;
-	new->left = NIL;
-	new->color = BLACK;
+void output_number(Output *output, uint64_t number) {
+	char 	digits[20];
+	int 	first = format_number(digits, number);
 
-	return new;
+	output_bytes(output, digits + first, 20 - first);
 }
 
 /*
- * Given a node,
- * returns the minimum
+ * Given a Buffer, some bytes and their number,
+ * appends the bytes to the Buffer, doubling its capacity if needed
  */
-node *tree_min(node *x) {
-	while (x->left != NIL)
-		x = x->left;
+void buffer_bytes(Buffer *buffer, const char *bytes, size_t length) {
+	if (buffer->length + length > buffer->capacity) {
+		buffer->capacity = buffer->capacity > 0 ? buffer->capacity * 2 : 64;
 
-	return x;
+		while (buffer->length + length > buffer->capacity) buffer->capacity *= 2;
+
+		buffer->bytes = realloc(buffer->bytes, buffer->capacity);
+	}
+
+	memcpy(buffer->bytes + buffer->length, bytes, length);
+	buffer->length += length;
 }
 
 /*
- * Given a node,
- * returns the maximum
+ * Given a Buffer and a number,
+ * appends the decimal digits of the number to the Buffer
  */
-node *tree_max(node *x) {
-	while (x->right != NIL)
-		x = x->right;
+void buffer_number(Buffer *buffer, uint64_t number) {
+	char 	digits[20];
+	int 	first = format_number(digits, number);
 
-	return x;
+	buffer_bytes(buffer, digits + first, 20 - first);
 }
 
+/****************************/
+/*	ENGINE FUNCTIONS    */
+/****************************/
+
 /*
- * Given a node,
- * returns the successor in the Tree
+ * Given the options and the file descriptor of the output,
+ * creates and returns an engine with no entities and no relations
  */
-node *tree_successor(node *x) {
-	if (x->right != NIL)
-		return tree_min(x->right);
+Engine *init_engine(Options *options, int fd) {
+	Engine *engine = malloc(sizeof(Engine));
 
-	node *y = x->p;
+	//Initializes the NIL node
+	init_nil(&engine->nil);
 
-	while (y != NIL && x == y->right) {
-		x = y;
-		y = y->p;
-	}
+	engine->forest = (Forest) { engine, &engine->nil, POOL_INIT(node), POOL_INIT(Tree) };
+	engine->list_pool = (Pool) POOL_INIT(list_t);
+	engine->entity_pool = (Pool) POOL_INIT(entity_t);
 
-	return y;
+	//Every entity ends with a SetShard for every worker thread
+	engine->set_shards = options->threads < 2 ? 1 : options->threads;
+	engine->entity_pool.object_size += engine->set_shards * sizeof(SetShard);
+
+	//Initializes the Hash Table and the entity indices
+	engine->entities = init_table(options->expected_entities);
+	init_indices(&engine->indices);
+	engine->order = (Tree) { &engine->nil, 0 };
+	//Initializes the head of the relation type list
+	engine->relation_types = init_list();
+	//Initializes the table of the relation type names
+	engine->types = init_types();
+
+	//Initializes the buffer of the output
+	init_output(&engine->output, fd);
+	engine->report = (Buffer) { NULL, 0, 0 };
+	engine->report_dirty = true;
+	engine->render_scratch = (Buffer) { NULL, 0, 0 };
+
+	//Commands are not logged until the log is recovered
+	engine->log = (CommandLog) { NULL, NULL, -1, { NULL, 0, 0 }, 0, 0, options->compact_records };
+
+	//Starts the worker threads, if any
+	init_workers(engine, options->threads);
+
+	return engine;
 }
 
 /*
- * Recursively frees in post-order all the nodes of the given tree
- * 'first' is used to reinitialize the tree only once
+ * Given an engine whose worker threads have been stopped,
+ * frees all the memory of the engine
  */
-void clear_tree(Tree *tree, node *root, bool first) {
-	if (root != NIL) {
-		clear_tree(tree, root->left, false);
-		clear_tree(tree, root->right, false);
+void clear_engine(Engine *engine) {
+	free(engine->output.buffer);
+	free(engine->report.bytes);
+	free(engine->render_scratch.bytes);
 
-		free(root);
+	clear_log(&engine->log);
 
-		//Executed once thanks to 'first' parameter
-		if (first) {
-			tree->root = NIL;
-			tree->size = 0;
-		}
-	}
+	//Frees all the nodes of the 'relation_types' list
+	clear_list(engine, engine->relation_types);
+	free(engine->relation_types);
+
+	clear_types(engine->types);
+	free(engine->types);
+
+	//Frees all memory allocated for relations and Entries
+	clear_hash_table(engine, engine->entities);
+	free(engine->entities);
+	clear_indices(&engine->indices);
+
+	//Frees the slabs of the pools
+	clear_pool(&engine->forest.node_pool);
+	clear_pool(&engine->forest.tree_pool);
+	clear_pool(&engine->list_pool);
+	clear_pool(&engine->entity_pool);
+
+	free(engine);
 }
 
 /*
- * Given a Tree and a node,
- * performs a RB-Tree left rotation
+ * Main function of a replay thread: replays the next input file until there are none left
  */
-void left_rotate(Tree *tree, node *x) {
-	node *y;
+void *replay_main(void *argument) {
+	Replay 		*replay = argument;
+	unsigned int 	index;
+	char 		*output_name;
+	FILE 		*input;
+	int 		fd;
 
-	y = x->right;
-	x->right = y->left;
+	while ((index = __atomic_fetch_add(&replay->next, 1, __ATOMIC_RELAXED)) < replay->count) {
+		input = fopen(replay->files[index], "r");
 
-	if (y->left != NIL) {
-		y->left->p = x;
-	}
+		output_name = malloc(strlen(replay->files[index]) + 5);
+		sprintf(output_name, "%s.out", replay->files[index]);
 
-	y->p = x->p;
+		fd = input != NULL ? open(output_name, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
 
-	if (x->p == NIL) {
-		tree->root = y;
-	} else if (x == x->p->left) {
-		x->p->left = y;
-	} else {
-		x->p->right = y;
+		if (fd != -1) {
+			if (!run_engine(replay->options, input, fd)) {
+				__atomic_store_n(&replay->failed, true, __ATOMIC_RELAXED);
+			}
+
+			close(fd);
+		} else {
+			perror(input != NULL ? output_name : replay->files[index]);
+			__atomic_store_n(&replay->failed, true, __ATOMIC_RELAXED);
+		}
+
+		if (input != NULL) fclose(input);
+		free(output_name);
 	}
 
-	y->left = x;
-	x->p = y;
+	return NULL;
 }
 
 /*
- * Given a Tree and a node,
- * performs a RB-Tree right rotation
+ * Given the options, the input files, their number and the number of jobs,
+ * replays the files on 'jobs' threads at the same time
+ *
+ * Returns 0 if all the files have been replayed, 1 otherwise (a file or the checkpoint could not be opened)
  */
-void right_rotate(Tree *tree, node *x) {
-	node *y;
+int replay_files(Options *options, char **files, unsigned int count, unsigned int jobs) {
+	Replay 		replay = { files, count, 0, options, false };
+	pthread_t 	*threads;
 
-	y = x->left;
-	x->left = y->right;
+	if (jobs < 1) jobs = 1;
+	if (jobs > count) jobs = count;
 
-	if (y->right != NIL) {
-		y->right->p = x;
+	threads = malloc(jobs * sizeof(pthread_t));
+
+	for (unsigned int i = 0; i < jobs; i++) {
+		pthread_create(&threads[i], NULL, replay_main, &replay);
 	}
 
-	y->p = x->p;
-	if (x->p == NIL) {
-		tree->root = y;
-	} else if (x == x->p->right) {
-		x->p->right = y;
-	} else {
-		x->p->left = y;
+	for (unsigned int i = 0; i < jobs; i++) {
+		pthread_join(threads[i], NULL);
 	}
 
-	y->right = x;
-	x->p = y;
+	free(threads);
+
+	return replay.failed ? 1 : 0;
 }
 
+/****************************/
+/*	WORKER FUNCTIONS    */
+/****************************/
+
 /*
- * Given a tree and a node,
- * rebalances the RB-Tree after insertion
+ * Given an engine and a number of threads,
+ * starts the worker threads of the engine, none if the number is lower than 2
  */
-void rb_insert_fixup(Tree *tree, node *z) {
-	node *y;
+void init_workers(Engine *engine, unsigned int count) {
+	engine->workers = NULL;
+	engine->workers_count = 0;
 
-	while (z->p->color == RED) {
+	if (count < 2) return;
+
+	engine->workers = malloc(count * sizeof(Worker));
+	engine->workers_count = count;
+
+	for (unsigned int i = 0; i < count; i++) {
+		Worker *worker = &engine->workers[i];
+
+		pthread_mutex_init(&worker->lock, NULL);
+		pthread_cond_init(&worker->changed, NULL);
+
+		worker->filling = malloc(TASK_BATCH * sizeof(Task));
+		worker->running = malloc(TASK_BATCH * sizeof(Task));
+		worker->filling_count = 0;
+		worker->running_count = 0;
+		worker->busy = false;
+		worker->quit = false;
+
+		//Every worker allocates from its own pools
+		worker->forest = (Forest) { engine, &engine->nil, POOL_INIT(node), POOL_INIT(Tree) };
+
+		pthread_create(&worker->thread, NULL, worker_main, worker);
+	}
+}
+
+/*
+ * Main function of a worker thread: executes the batches handed by the main thread until it has to quit
+ */
+void *worker_main(void *argument) {
+	Worker 	*worker = argument;
+	Forest 	*forest = &worker->forest;
+	Task 	*task;
+
+	pthread_mutex_lock(&worker->lock);
+
+	while (true) {
+		while (!worker->busy && !worker->quit) {
+			pthread_cond_wait(&worker->changed, &worker->lock);
+		}
+
+		if (!worker->busy) break;
+
+		pthread_mutex_unlock(&worker->lock);
+
+		for (size_t i = 0; i < worker->running_count; i++) {
+			task = &worker->running[i];
+
+			switch (task->kind) {
+				case ADD_RELATION:
+					add_relation(forest, task->from, task->to, task->data_list);
+					break;
+				case DELETE_RELATION:
+					if (delete_relation(forest, task->from, task->to, task->data_list)) {
+						lower_data_maximum(task->data_list);
+					}
+					break;
+				case DELETE_ENTITY:
+					delete_shard_relations(forest, task->from, &task->from->shards[worker - forest->engine->workers]);
+					break;
+			}
+		}
+
+		pthread_mutex_lock(&worker->lock);
+
+		worker->busy = false;
+		pthread_cond_broadcast(&worker->changed);
+	}
+
+	pthread_mutex_unlock(&worker->lock);
+
+	return NULL;
+}
+
+/*
+ * Given a Worker,
+ * waits until it has executed its last batch and hands it the batch filled by the main thread
+ */
+void worker_submit(Worker *worker) {
+	Task *batch;
+
+	pthread_mutex_lock(&worker->lock);
+
+	while (worker->busy) {
+		pthread_cond_wait(&worker->changed, &worker->lock);
+	}
+
+	//Swaps the batches, the executed one is filled next
+	batch = worker->running;
+	worker->running = worker->filling;
+	worker->running_count = worker->filling_count;
+	worker->filling = batch;
+	worker->filling_count = 0;
+
+	worker->busy = true;
+	pthread_cond_broadcast(&worker->changed);
+
+	pthread_mutex_unlock(&worker->lock);
+}
+
+/*
+ * Given the entities and the data list of a relation and the kind of Task,
+ * appends the Task to the batch of the worker owning the relation type
+ */
+void dispatch(Engine *engine, entity_t *from, entity_t *to, list_t *data_list, TaskKind kind) {
+	worker_append(&engine->workers[data_list->type_id % engine->workers_count], (Task) { from, to, data_list, kind });
+}
+
+/*
+ * Given a Worker and a Task,
+ * appends the Task to the batch of the worker, handing the batch to it when full
+ */
+void worker_append(Worker *worker, Task task) {
+	worker->filling[worker->filling_count++] = task;
+
+	if (worker->filling_count == TASK_BATCH) {
+		worker_submit(worker);
+	}
+}
+
+/*
+ * Given a worker, hands it its batch if not empty and waits until it has executed all its tasks
+ *
+ * Used by the commands that read a single relation type
+ */
+void worker_wait(Worker *worker) {
+	if (worker->filling_count > 0) {
+		worker_submit(worker);
+	}
+
+	pthread_mutex_lock(&worker->lock);
+
+	while (worker->busy) {
+		pthread_cond_wait(&worker->changed, &worker->lock);
+	}
+
+	pthread_mutex_unlock(&worker->lock);
+}
+
+/*
+ * Hands the batches not full yet to the workers and waits until every worker has executed all its tasks
+ */
+void workers_wait(Engine *engine) {
+	Worker *worker;
+
+	for (unsigned int i = 0; i < engine->workers_count; i++) {
+		if (engine->workers[i].filling_count > 0) {
+			worker_submit(&engine->workers[i]);
+		}
+	}
+
+	for (unsigned int i = 0; i < engine->workers_count; i++) {
+		worker = &engine->workers[i];
+
+		pthread_mutex_lock(&worker->lock);
+
+		while (worker->busy) {
+			pthread_cond_wait(&worker->changed, &worker->lock);
+		}
+
+		pthread_mutex_unlock(&worker->lock);
+	}
+}
+
+/*
+ * Waits for the workers with 'workers_wait', then deletes the relation types left without relations,
+ * that the workers can't remove from the shared 'relation_types' list
+ *
+ * Used before the commands that touch every relation type
+ */
+void workers_barrier(Engine *engine) {
+	list_t *rel_cursor, *next;
+
+	if (engine->workers_count == 0) return;
+
+	workers_wait(engine);
+
+	rel_cursor = engine->relation_types->head;
+
+	while (rel_cursor != NULL) {
+		next = rel_cursor->next;
+
+		restore_data_maximum(engine, rel_cursor);
+
+		rel_cursor = next;
+	}
+}
+
+/*
+ * Waits for the last tasks, stops the worker threads and moves their pools into the ones of the engine
+ */
+void clear_workers(Engine *engine) {
+	Worker *worker;
+
+	if (engine->workers_count == 0) return;
+
+	workers_barrier(engine);
+
+	for (unsigned int i = 0; i < engine->workers_count; i++) {
+		worker = &engine->workers[i];
+
+		pthread_mutex_lock(&worker->lock);
+		worker->quit = true;
+		pthread_cond_broadcast(&worker->changed);
+		pthread_mutex_unlock(&worker->lock);
+
+		pthread_join(worker->thread, NULL);
+
+		pool_merge(&engine->forest.node_pool, &worker->forest.node_pool);
+		pool_merge(&engine->forest.tree_pool, &worker->forest.tree_pool);
+
+		pthread_mutex_destroy(&worker->lock);
+		pthread_cond_destroy(&worker->changed);
+		free(worker->filling);
+		free(worker->running);
+	}
+
+	free(engine->workers);
+	engine->workers_count = 0;
+}
+
+/****************************/
+/*	POOL FUNCTIONS	    */
+/****************************/
+
+/*
+ * Given a Pool,
+ * returns an object taken from the free list, or from the last slab if the free list is empty
+ *
+ * A new slab is allocated when the last one has been used completely
+ */
+void *pool_alloc(Pool *pool) {
+	void *object;
+
+	if (pool->free_list != NULL) {
+		//Pops the last freed object
+		object = pool->free_list;
+		pool->free_list = *(void **) object;
+	} else {
+		if (pool->slab_used == POOL_SLAB_OBJECTS) {
+			//The first object size of the slab is used to link the previous one
+			void *slab = malloc((POOL_SLAB_OBJECTS + 1) * pool->object_size);
+
+			*(void **) slab = pool->slabs;
+			pool->slabs = slab;
+			pool->slab_used = 0;
+		}
+
+		pool->slab_used++;
+		object = (char *) pool->slabs + pool->slab_used * pool->object_size;
+	}
+
+	pool->live++;
+
+	if (pool->live > pool->peak) {
+		pool->peak = pool->live;
+	}
+
+	return object;
+}
+
+/*
+ * Given a Pool and one of its objects,
+ * puts the object in the free list of the pool
+ */
+void pool_free(Pool *pool, void *object) {
+	*(void **) object = pool->free_list;
+	pool->free_list = object;
+
+	pool->live--;
+}
+
+/*
+ * Frees all the slabs of the given Pool, objects still in use included
+ */
+void clear_pool(Pool *pool) {
+	void *slab;
+
+	while (pool->slabs != NULL) {
+		slab = pool->slabs;
+		pool->slabs = *(void **) slab;
+
+		free(slab);
+	}
+
+	pool->free_list = NULL;
+	pool->slab_used = POOL_SLAB_OBJECTS;
+}
+
+/*
+ * Given two Pools of the same objects,
+ * moves the slabs and the free objects of the second one into the first one
+ *
+ * Used for the pools of the worker threads, objects allocated by one thread can be freed
+ * by another, so the live objects of a single pool can be negative and only their sum is exact.
+ * The objects live at the same time are never more than the sum of the peaks, which is printed
+ * as the peak of the merged pool, but can be less than it
+ */
+void pool_merge(Pool *pool, Pool *other) {
+	void **last;
+
+	//Appends the slabs of 'other' after the oldest slab, the last one keeps being used
+	for (last = &pool->slabs; *last != NULL; last = (void **) *last);
+	*last = other->slabs;
+
+	for (last = &pool->free_list; *last != NULL; last = (void **) *last);
+	*last = other->free_list;
+
+	pool->live += other->live;
+	pool->peak += other->peak;
+
+	other->slabs = NULL;
+	other->free_list = NULL;
+}
+
+/*
+ * Prints the live and peak objects of the given Pool on stderr
+ */
+void print_pool(char *name, Pool *pool) {
+	fprintf(stderr, "%s pool: %ld live, %ld peak, %zu bytes per object\n",
+		name, pool->live, pool->peak, pool->object_size);
+}
+
+/****************************/
+/*	LIST FUNCTIONS	    */
+/****************************/
+
+/*
+ * Inizializes a new list
+ */
+List *init_list(void) {
+	List *list = malloc(sizeof(List));
+	list->head = NULL;
+
+	return list;
+}
+
+/*
+ * Given an engine, its list and a string 'key'
+ * inserts the node in the list in alphabetic order
+ *
+ * Does not check if the given 'key' is already present,
+ * so 'types' needs to be checked first
+ */
+list_t *list_insert(Engine *engine, List *list, char *key) {
+	//Creates and initializes the node
+	list_t 		*new = pool_alloc(&engine->list_pool);
+	list_t 		*cursor, *prev;
+
+	new->key = strdup(key);
+	new->current_maximum = 0;
+
+	mark_dirty(engine, new);
+
+	//Room for the first degrees, the trees are allocated by 'move_degree' when needed
+	new->degrees_size = 4;
+	new->degrees = calloc(new->degrees_size, sizeof(Tree *));
+
+	prev = NULL;
+	cursor = list->head;
+
+	//Exits when found position or out of the list (tail insertion)
+	while (cursor != NULL && strcmp(cursor->key, key) < 0) {
+		prev = cursor;
+		cursor = cursor->next;
+	}
+
+	if (prev == NULL) {//If the element is to be put as the new head
+		new->next = list->head;
+		list->head = new;
+	} else {
+		//Node linking
+		prev->next = new;
+		new->next = cursor;
+	}
+
+	return new;
+}
+
+/*
+ * Given an engine, its list and one of its nodes,
+ * unlinks the node from the list and frees it
+ */
+void list_delete(Engine *engine, List *list, list_t *todelete) {
+	list_t *prev;
+
+	if (list->head == todelete) {
+		//Sets the head of the list to the second element
+		list->head = todelete->next;
+	} else {
+		prev = list->head;
+
+		while (prev->next != todelete) {
+			prev = prev->next;
+		}
+
+		//Node linking
+		prev->next = todelete->next;
+	}
+
+	//Frees all allocated memory
+	clear_list_node(engine, todelete);
+}
+
+/*
+ * Given an engine and a list node,
+ * frees its trees and the node itself
+ */
+void clear_list_node(Engine *engine, list_t *todelete) {
+	for (uint64_t i = 0; i < todelete->degrees_size; i++) {
+		if (todelete->degrees[i] == NULL) continue;
+
+		clear_tree(&engine->forest, todelete->degrees[i], todelete->degrees[i]->root, true);
+		pool_free(&engine->forest.tree_pool, todelete->degrees[i]);
+	}
+
+	free(todelete->degrees);
+	free(todelete->key);
+	pool_free(&engine->list_pool, todelete);
+}
+
+/*
+ * Given an engine and its list,
+ * deletes all nodes and frees the memory
+ */
+void clear_list(Engine *engine, List *list) {
+	list_t *cursor = list->head, *temp;
+
+	while (cursor != NULL) {
+		//Gets the element to delete and goes further by one element
+		temp = cursor;
+		cursor = cursor->next;
+
+		//Frees all allocated memory
+		clear_list_node(engine, temp);
+	}
+}
+
+/*
+ * Prints the given list
+ *
+ * Only used for debugging
+ */
+void print_list(List *list) {
+	printf("\ndebug list:\n");
+	list_t *cursor = list->head;
+
+	while (cursor != NULL) {
+		printf("%s\t", cursor->key);
+
+		cursor = cursor->next;
+	}
+	printf("\n\n");
+}
+
+/********************************/
+/*		TYPE TABLE FUNCTIONS	*/
+/********************************/
+
+/*
+ * Creates and returns an empty TypeTable
+ */
+TypeTable *init_types(void) {
+	TypeTable *types = malloc(sizeof(TypeTable));
+
+	types->count = 0;
+	types->capacity = 8;
+	types->names = malloc(types->capacity * sizeof(char *));
+	types->data = malloc(types->capacity * sizeof(list_t *));
+	types->rendered = malloc(types->capacity * sizeof(Buffer));
+
+	types->index_size = 16;
+	types->index = malloc(types->index_size * sizeof(int));
+
+	for (unsigned int i = 0; i < types->index_size; i++) {
+		types->index[i] = -1;
+	}
+
+	return types;
+}
+
+/*
+ * Given a TypeTable and a type name,
+ * returns the position in 'index' where the id of the type is, or where it should be inserted
+ */
+unsigned int type_index(TypeTable *types, Slice type) {
+	unsigned int 	mask = types->index_size - 1, position = hash_string(type.start, type.length) & mask;
+	char 		*name;
+
+	while (types->index[position] != -1) {
+		name = types->names[types->index[position]];
+
+		if (strncmp(name, type.start, type.length) == 0 && name[type.length] == '\0') break;
+
+		position = (position + 1) & mask;
+	}
+
+	return position;
+}
+
+/*
+ * Given a TypeTable and a type name,
+ * returns the id of the type, -1 if it was never interned
+ */
+int type_search(TypeTable *types, Slice type) {
+	return types->index[type_index(types, type)];
+}
+
+/*
+ * Given a TypeTable and a type name,
+ * returns the id of the type, interning the name if it's not present
+ */
+unsigned int type_intern(TypeTable *types, Slice type) {
+	unsigned int position = type_index(types, type);
+
+	if (types->index[position] != -1) return types->index[position];
+
+	//Doubles the arrays indexed by id if needed
+	if (types->count == types->capacity) {
+		types->capacity *= 2;
+		types->names = realloc(types->names, types->capacity * sizeof(char *));
+		types->data = realloc(types->data, types->capacity * sizeof(list_t *));
+		types->rendered = realloc(types->rendered, types->capacity * sizeof(Buffer));
+	}
+
+	types->names[types->count] = strndup(type.start, type.length);
+	types->data[types->count] = NULL;
+	types->rendered[types->count] = (Buffer) { NULL, 0, 0 };
+	types->index[position] = types->count;
+	types->count++;
+
+	//Doubles the index if more than half full, inserting again all the ids
+	if (types->count * 2 > types->index_size) {
+		free(types->index);
+
+		types->index_size *= 2;
+		types->index = malloc(types->index_size * sizeof(int));
+
+		for (unsigned int i = 0; i < types->index_size; i++) {
+			types->index[i] = -1;
+		}
+
+		for (unsigned int id = 0; id < types->count; id++) {
+			Slice name = { types->names[id], strlen(types->names[id]) };
+
+			types->index[type_index(types, name)] = id;
+		}
+	}
+
+	return types->count - 1;
+}
+
+/*
+ * Frees the names and the arrays of the given TypeTable
+ */
+void clear_types(TypeTable *types) {
+	for (unsigned int id = 0; id < types->count; id++) {
+		free(types->names[id]);
+		free(types->rendered[id].bytes);
+	}
+
+	free(types->names);
+	free(types->data);
+	free(types->rendered);
+	free(types->index);
+}
+
+/********************************/
+/*	ENTITY INDEX FUNCTIONS	*/
+/********************************/
+
+/*
+ * Given an EntityIndex,
+ * initializes it without any index used
+ *
+ * Only the array of pages is allocated, the pages are allocated when first used
+ */
+void init_indices(EntityIndex *indices) {
+	indices->pages = calloc(1u << INDEX_PAGE_BITS, sizeof(entity_t **));
+	indices->next = 0;
+	indices->free = NULL;
+	indices->free_count = 0;
+	indices->free_capacity = 0;
+}
+
+/*
+ * Given an EntityIndex and an entity_t,
+ * gives the entity a free index, the most recently freed one or the next one never used
+ */
+void index_acquire(EntityIndex *indices, entity_t *ent) {
+	uint32_t 	index = indices->free_count > 0 ? indices->free[--indices->free_count] : indices->next++;
+	entity_t 	***page = &indices->pages[index >> INDEX_PAGE_BITS];
+
+	if (*page == NULL) {
+		*page = malloc((1u << INDEX_PAGE_BITS) * sizeof(entity_t *));
+	}
+
+	(*page)[index & ((1u << INDEX_PAGE_BITS) - 1)] = ent;
+	ent->index = index;
+}
+
+/*
+ * Given an EntityIndex and an entity_t being deleted,
+ * frees the index of the entity, so that it's given to the next inserted entity
+ */
+void index_release(EntityIndex *indices, entity_t *ent) {
+	if (indices->free_count == indices->free_capacity) {
+		indices->free_capacity = indices->free_capacity > 0 ? indices->free_capacity * 2 : 64;
+		indices->free = realloc(indices->free, indices->free_capacity * sizeof(uint32_t));
+	}
+
+	indices->pages[ent->index >> INDEX_PAGE_BITS][ent->index & ((1u << INDEX_PAGE_BITS) - 1)] = NULL;
+	indices->free[indices->free_count++] = ent->index;
+}
+
+/*
+ * Given an EntityIndex and an index,
+ * returns the entity_t with that index, NULL if it was deleted
+ */
+entity_t *index_entity(EntityIndex *indices, uint32_t index) {
+	return indices->pages[index >> INDEX_PAGE_BITS][index & ((1u << INDEX_PAGE_BITS) - 1)];
+}
+
+/*
+ * Frees the pages and the free indices of the given EntityIndex
+ */
+void clear_indices(EntityIndex *indices) {
+	for (unsigned long page = 0; page < (1ul << INDEX_PAGE_BITS); page++) {
+		free(indices->pages[page]);
+	}
+
+	free(indices->pages);
+	free(indices->free);
+}
+
+/********************************/
+/*	ENTITY SET FUNCTIONS	*/
+/********************************/
+
+/*
+ * Given an EntitySet,
+ * initializes it empty, storing the indices inline
+ */
+void init_set(EntitySet *set) {
+	set->slots = NULL;
+	set->count = 0;
+	set->capacity = 0;
+	set->kind = SET_INLINE;
+}
+
+/*
+ * Given the index of an entity and the capacity of a hash set,
+ * returns the first slot where the index is looked for
+ *
+ * The index is multiplied by a 64 bit odd constant and the high bits are kept,
+ * consecutive indices end up far from each other
+ */
+static inline uint32_t set_slot(uint32_t index, uint32_t capacity) {
+	return (uint32_t) ((index * 0x9E3779B97F4A7C15ull) >> 32) & (capacity - 1);
+}
+
+/*
+ * Given a number of entities,
+ * returns the slots of the smallest hash table that can store them
+ */
+static uint32_t hash_capacity(uint32_t count) {
+	uint32_t capacity = SET_MIN_CAPACITY;
+
+	while ((uint64_t) count * 4 > (uint64_t) capacity * SET_MAX_LOAD) {
+		capacity *= 2;
+	}
+
+	return capacity;
+}
+
+/*
+ * Given a number of indices (the highest one + 1),
+ * returns the words of a bitmap with a bit for each of them, a power of 2 so that a growing bitmap doubles
+ */
+static uint32_t bitmap_capacity(uint64_t range) {
+	uint32_t capacity = 1;
+
+	while ((uint64_t) capacity * 64 < range) {
+		capacity *= 2;
+	}
+
+	return capacity;
+}
+
+/*
+ * Given an EntitySet and a cursor, 0 to start from the first index,
+ * returns the next index of the set and moves the cursor after it, SET_EMPTY when all of them were returned
+ *
+ * The set can't be modified until all the indices are returned
+ */
+uint32_t set_next(EntitySet *set, uint32_t *cursor) {
+	uint64_t 	word;
+	uint32_t 	position;
+
+	if (set->kind == SET_INLINE) {
+		return *cursor < set->count ? set->members[(*cursor)++] : SET_EMPTY;
+	}
+
+	if (set->kind == SET_HASH) {
+		while (*cursor < set->capacity) {
+			if (set->slots[*cursor] != SET_EMPTY) return set->slots[(*cursor)++];
+
+			(*cursor)++;
+		}
+
+		return SET_EMPTY;
+	}
+
+	//The cursor is the next bit to check, the bits before it in its word are masked out
+	if ((*cursor >> 6) >= set->capacity) return SET_EMPTY;
+
+	position = *cursor >> 6;
+	word = set->bits[position] & (~0ull << (*cursor & 63));
+
+	while (word == 0) {
+		if (++position >= set->capacity) return SET_EMPTY;
+
+		word = set->bits[position];
+	}
+
+	*cursor = (position << 6) + __builtin_ctzll(word) + 1;
+
+	return *cursor - 1;
+}
+
+/*
+ * Given an EntitySet of any kind and an index,
+ * returns TRUE if the index is in the set
+ */
+bool set_contains(EntitySet *set, uint32_t index) {
+	uint32_t slot;
+
+	switch (set->kind) {
+		case SET_INLINE:
+			for (uint32_t i = 0; i < set->count; i++) {
+				if (set->members[i] == index) return true;
+			}
+
+			return false;
+
+		case SET_HASH:
+			for (slot = set_slot(index, set->capacity); set->slots[slot] != SET_EMPTY; slot = (slot + 1) & (set->capacity - 1)) {
+				if (set->slots[slot] == index) return true;
+			}
+
+			return false;
+
+		default:
+			return (index >> 6) < set->capacity && (set->bits[index >> 6] >> (index & 63)) & 1;
+	}
+}
+
+/*
+ * Given an EntitySet with room for one more index and an index not in the set,
+ * stores the index, without counting it
+ */
+static void set_put(EntitySet *set, uint32_t index) {
+	uint32_t slot;
+
+	switch (set->kind) {
+		case SET_INLINE:
+			set->members[set->count] = index;
+			break;
+
+		case SET_HASH:
+			for (slot = set_slot(index, set->capacity); set->slots[slot] != SET_EMPTY; slot = (slot + 1) & (set->capacity - 1));
+
+			set->slots[slot] = index;
+			break;
+
+		default:
+			set->bits[index >> 6] |= 1ull << (index & 63);
+	}
+}
+
+/*
+ * Given an EntitySet, the number of entities it needs to store and the number of indices they can have
+ * (the highest one + 1), moves the indices of the set into the kind of set that stores them in less memory
+ *
+ * An inline set is never bigger than the others, a bitmap is taken when it's not bigger than the hash table
+ */
+static void set_rebuild(EntitySet *set, uint32_t count, uint64_t range) {
+	EntitySet 	old = *set;
+	uint32_t 	cursor = 0, index;
+
+	if (count <= SET_INLINE_MEMBERS) {
+		set->kind = SET_INLINE;
+		set->capacity = 0;
+	} else if ((uint64_t) bitmap_capacity(range) * sizeof(uint64_t) <= (uint64_t) hash_capacity(count) * sizeof(uint32_t)) {
+		set->kind = SET_BITMAP;
+		set->capacity = bitmap_capacity(range);
+		set->bits = calloc(set->capacity, sizeof(uint64_t));
+	} else {
+		set->kind = SET_HASH;
+		set->capacity = hash_capacity(count);
+		set->slots = malloc(set->capacity * sizeof(uint32_t));
+
+		memset(set->slots, 0xFF, set->capacity * sizeof(uint32_t));
+	}
+
+	set->count = 0;
+
+	//An inline set being rebuilt inline keeps its members where they are
+	if (old.kind == SET_INLINE && set->kind == SET_INLINE) {
+		set->count = old.count;
+		return;
+	}
+
+	while ((index = set_next(&old, &cursor)) != SET_EMPTY) {
+		set_put(set, index);
+		set->count++;
+	}
+
+	if (old.kind != SET_INLINE) free(old.slots);
+}
+
+/*
+ * Given an EntitySet,
+ * returns the number of indices its entities can have: the highest one + 1
+ */
+static uint64_t set_range(EntitySet *set) {
+	uint32_t 	cursor = 0, index;
+	uint64_t 	range = 0;
+
+	if (set->kind == SET_BITMAP) return (uint64_t) set->capacity * 64;
+
+	while ((index = set_next(set, &cursor)) != SET_EMPTY) {
+		if (index >= range) range = (uint64_t) index + 1;
+	}
+
+	return range;
+}
+
+/*
+ * Given an EntitySet, a number of entities and the number of indices they can have (the highest one + 1),
+ * makes the set of the right kind and size to store them without growing again
+ */
+void set_reserve(EntitySet *set, uint32_t count, uint64_t range) {
+	uint64_t current = set_range(set);
+
+	if (count > set->count) set_rebuild(set, count, current > range ? current : range);
+}
+
+/*
+ * Given an EntitySet and the index of an entity,
+ * inserts the index in the set, changing the kind of the set if it's full
+ *
+ * Returns FALSE if the index was already in the set
+ */
+bool set_insert(EntitySet *set, uint32_t index) {
+	bool 		full;
+	uint64_t 	range;
+
+	if (set_contains(set, index)) return false;
+
+	switch (set->kind) {
+		case SET_INLINE:
+			full = set->count == SET_INLINE_MEMBERS;
+			break;
+
+		case SET_HASH:
+			full = (uint64_t) (set->count + 1) * 4 > (uint64_t) set->capacity * SET_MAX_LOAD;
+			break;
+
+		default:
+			full = (index >> 6) >= set->capacity;
+	}
+
+	if (full) {
+		range = set_range(set);
+		set_rebuild(set, set->count + 1, index >= range ? (uint64_t) index + 1 : range);
+	}
+
+	set_put(set, index);
+	set->count++;
+
+	return true;
+}
+
+/*
+ * Given an EntitySet and the index of an entity,
+ * removes the index from the set
+ *
+ * In a hash set, the following indices that would be found before the freed slot are moved back into it,
+ * so the probing of every index still ends at the first empty slot.
+ * Returns FALSE if the index was not in the set
+ */
+bool set_remove(EntitySet *set, uint32_t index) {
+	uint32_t 	mask = set->capacity - 1, slot, next, home;
+
+	if (!set_contains(set, index)) return false;
+
+	set->count--;
+
+	if (set->kind == SET_INLINE) {
+		for (slot = 0; set->members[slot] != index; slot++);
+
+		//The last index takes its place
+		set->members[slot] = set->members[set->count];
+		return true;
+	}
+
+	if (set->kind == SET_BITMAP) {
+		set->bits[index >> 6] &= ~(1ull << (index & 63));
+		return true;
+	}
+
+	for (slot = set_slot(index, set->capacity); set->slots[slot] != index; slot = (slot + 1) & mask);
+
+	for (next = (slot + 1) & mask; set->slots[next] != SET_EMPTY; next = (next + 1) & mask) {
+		home = set_slot(set->slots[next], set->capacity);
+
+		//Moved back only if the freed slot is between its first slot and the current one
+		if (((next - home) & mask) >= ((next - slot) & mask)) {
+			set->slots[slot] = set->slots[next];
+			slot = next;
+		}
+	}
+
+	set->slots[slot] = SET_EMPTY;
+
+	return true;
+}
+
+/*
+ * Frees the indices of the given EntitySet, leaving it empty
+ */
+void clear_set(EntitySet *set) {
+	if (set->kind != SET_INLINE) free(set->slots);
+
+	init_set(set);
+}
+
+/*
+ * Given a SetShard with at least a slot and a type id,
+ * returns the slot of the type in the shard, or the empty one where it would be added
+ *
+ * The first slot is found like the one of an index in an EntitySet, so the types of a worker
+ * (all with the same remainder) are spread as much as consecutive ones
+ */
+static inline TypeSets *shard_slot(SetShard *shard, unsigned int type_id) {
+	uint32_t 	mask = shard->capacity - 1;
+	uint32_t 	index = set_slot(type_id, shard->capacity);
+
+	while (shard->slots[index].type_id != type_id && shard->slots[index].type_id != SET_EMPTY) {
+		index = (index + 1) & mask;
+	}
+
+	return &shard->slots[index];
+}
+
+/*
+ * Given an engine, an entity_t and a type id,
+ * returns the SetShard of the entity with the type, the one of its owner
+ */
+SetShard *entity_shard(Engine *engine, entity_t *ent, unsigned int type_id) {
+	return &ent->shards[type_id % engine->set_shards];
+}
+
+/*
+ * Given an engine, an entity_t and a type id,
+ * returns the sets of the entity with the relations of that type, NULL if it never had one
+ */
+TypeSets *entity_sets(Engine *engine, entity_t *ent, unsigned int type_id) {
+	SetShard 	*shard = entity_shard(engine, ent, type_id);
+	TypeSets 	*sets;
+
+	if (shard->count == 0) return NULL;
+
+	sets = shard_slot(shard, type_id);
+
+	return sets->type_id == type_id ? sets : NULL;
+}
+
+/*
+ * Given a SetShard,
+ * doubles its slots and moves the types into the new ones
+ */
+static void shard_grow(SetShard *shard) {
+	TypeSets 	*old = shard->slots;
+	uint32_t 	old_capacity = shard->capacity;
+
+	shard->capacity = old_capacity == 0 ? 2 : old_capacity * 2;
+	shard->slots = malloc(shard->capacity * sizeof(TypeSets));
+
+	for (uint32_t i = 0; i < shard->capacity; i++) {
+		init_set(&shard->slots[i].in);
+		init_set(&shard->slots[i].out);
+		shard->slots[i].type_id = SET_EMPTY;
+	}
+
+	for (uint32_t i = 0; i < old_capacity; i++) {
+		if (old[i].type_id != SET_EMPTY) {
+			*shard_slot(shard, old[i].type_id) = old[i];
+		}
+	}
+
+	free(old);
+}
+
+/*
+ * Given an engine, an entity_t and the data list of a relation type,
+ * returns the sets of the entity with the relations of that type, added if it doesn't have them yet
+ *
+ * With worker threads, it's executed by the owner of the type
+ */
+TypeSets *entity_add_sets(Engine *engine, entity_t *ent, list_t *data_list) {
+	unsigned int 	type_id = data_list->type_id;
+	SetShard 	*shard;
+	TypeSets 	*sets;
+
+	shard = entity_shard(engine, ent, type_id);
+
+	if (shard->count == 0 || (sets = shard_slot(shard, type_id))->type_id != type_id) {
+		//The table grows if the new type would use more than SHARD_MAX_LOAD quarters of it
+		if ((shard->count + 1) * 4 > shard->capacity * SHARD_MAX_LOAD) {
+			shard_grow(shard);
+		}
+
+		sets = shard_slot(shard, type_id);
+		sets->type_id = type_id;
+		shard->count++;
+	}
+
+	//The type may have been deleted and added again since the sets were added
+	sets->data_list = data_list;
+
+	return sets;
+}
+
+/********************************/
+/*		HASH TABLE FUNCTIONS	*/
+/********************************/
+
+/*
+ * Given the expected number of entities (0 if unknown),
+ * returns the number of slots needed to store them without growing
+ */
+static unsigned long table_size(unsigned long expected) {
+	unsigned long size = HASH_DIMENSION;
+
+	while (size * HASH_MAX_LOAD < expected * 8) {
+		size *= 2;
+	}
+
+	return size;
+}
+
+/*
+ * Given the expected number of entities (0 if unknown),
+ * creates and returns an HashTable big enough to store them without growing
+ */
+HashTable *init_table(unsigned long expected) {
+	HashTable *ht = malloc(sizeof(HashTable));
+
+	init_slots(&ht->table, table_size(expected));
+	ht->count = 0;
+
+	ht->old_table.ctrl = NULL;
+	ht->rehash_index = 0;
+
+	return ht;
+}
+
+/*
+ * Given a number of bytes,
+ * allocates them aligned to huge pages if they are at least HUGE_PAGE_BYTES, asking the kernel to use huge pages
+ */
+static void *table_alloc(size_t bytes) {
+	void *memory;
+
+	if (bytes < HUGE_PAGE_BYTES || posix_memalign(&memory, HUGE_PAGE_BYTES, bytes) != 0) return malloc(bytes);
+
+	madvise(memory, bytes, MADV_HUGEPAGE);
+
+	return memory;
+}
+
+/*
+ * Given an HashSlots and a size,
+ * allocates 'size' empty slots
+ */
+void init_slots(HashSlots *hs, unsigned long size) {
+	hs->ctrl = table_alloc(size + GROUP_SIZE);
+	hs->slots = table_alloc(size * sizeof(entity_t *));
+	hs->hashes = table_alloc(size * sizeof(uint32_t));
+	hs->size = size;
+	hs->used = 0;
+
+	memset(hs->ctrl, CTRL_EMPTY, size + GROUP_SIZE);
+}
+
+/*
+ * Initializes the key of the hash function from '/dev/urandom',
+ * falls back to the current time if it can't be read
+ */
+void init_hash_seed(void) {
+	FILE *random = fopen("/dev/urandom", "rb");
+
+	if (random == NULL || fread(HASH_SEED, sizeof(HASH_SEED), 1, random) != 1) {
+		HASH_SEED[0] = (uint64_t) time(NULL) * 0x9E3779B97F4A7C15ull;
+		HASH_SEED[1] = (uint64_t) (uintptr_t) &random ^ 0xC2B2AE3D27D4EB4Full;
+	}
+
+	if (random != NULL) fclose(random);
+}
+
+/*
+ * Reads 'length' bytes (at most 8) from the string as a little endian integer
+ */
+static inline uint64_t read_bytes(const char *bytes, int length) {
+	uint64_t value = 0;
+
+	memcpy(&value, bytes, length);
+
+	return value;
+}
+
+#ifdef HASH_SIPHASH
+
+#define ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND(v0, v1, v2, v3) do { 						\
+		v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); 	\
+		v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; 				\
+		v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; 				\
+		v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); 	\
+	} while (0)
+
+/*
+ * Given a string and its length
+ * returns its 64 bit hash, computed with SipHash-1-3 keyed with 'HASH_SEED'
+ */
+uint64_t hash_string(char *to_hash, unsigned int length) {
+	unsigned int 	i;
+	uint64_t 	v0 = HASH_SEED[0] ^ 0x736F6D6570736575ull;
+	uint64_t 	v1 = HASH_SEED[1] ^ 0x646F72616E646F6Dull;
+	uint64_t 	v2 = HASH_SEED[0] ^ 0x6C7967656E657261ull;
+	uint64_t 	v3 = HASH_SEED[1] ^ 0x7465646279746573ull;
+	uint64_t 	word;
+
+	//Compresses the string 8 bytes at a time
+	for (i = 0; i + 8 <= length; i += 8) {
+		word = read_bytes(to_hash + i, 8);
+
+		v3 ^= word;
+		SIPROUND(v0, v1, v2, v3);
+		v0 ^= word;
+	}
+
+	//Last word, with the length in the most significant byte
+	word = read_bytes(to_hash + i, length - i) | ((uint64_t) length << 56);
+
+	v3 ^= word;
+	SIPROUND(v0, v1, v2, v3);
+	v0 ^= word;
+
+	//Finalization
+	v2 ^= 0xFF;
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+#else
+
+/*
+ * Multiplies the two values and folds the 128 bit result into 64 bits
+ */
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+	__uint128_t result = (__uint128_t) a * b;
+
+	return (uint64_t) result ^ (uint64_t) (result >> 64);
+}
+
+/*
+ * Given a string and its length
+ * returns its 64 bit hash, seeded with 'HASH_SEED'
+ *
+ * Every block of 8 characters is mixed into the hash with a 128 bit multiplication,
+ * so every character (and its position) changes all the bits of the result
+ */
+uint64_t hash_string(char *to_hash, unsigned int length) {
+	unsigned int 	i;
+	uint64_t 	hash = HASH_SEED[0] ^ ((uint64_t) length * 0xA0761D6478BD642Full);
+
+	for (i = 0; i + 8 <= length; i += 8) {
+		hash = hash_mix(hash ^ read_bytes(to_hash + i, 8), HASH_SEED[1] ^ 0xE7037ED1A0B428DBull);
+	}
+
+	hash = hash_mix(hash ^ read_bytes(to_hash + i, length - i), HASH_SEED[1] ^ 0x8EBC6AF09C88C6E3ull);
+
+	return hash_mix(hash, 0x589965CC75374CC3ull);
+}
+
+#endif
+
+#if defined(__AVX2__)
+
+/*
+ * Given the control bytes of a group and a value,
+ * returns a mask with the bits of the bytes equal to the value set
+ */
+static inline uint32_t group_match(const int8_t *ctrl, int8_t value) {
+	__m256i group = _mm256_loadu_si256((const __m256i *) ctrl);
+
+	return (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(group, _mm256_set1_epi8(value)));
+}
+
+/*
+ * Given the control bytes of a group,
+ * returns a mask with the bits of the empty and deleted slots set (the ones with the highest bit set)
+ */
+static inline uint32_t group_match_free(const int8_t *ctrl) {
+	return (uint32_t) _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *) ctrl));
+}
+
+#elif defined(__SSE2__)
+
+static inline uint32_t group_match(const int8_t *ctrl, int8_t value) {
+	__m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+
+	return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(value)));
+}
+
+static inline uint32_t group_match_free(const int8_t *ctrl) {
+	return (uint32_t) _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) ctrl));
+}
+
+#else
+
+static inline uint32_t group_match(const int8_t *ctrl, int8_t value) {
+	uint32_t mask = 0;
+
+	for (int i = 0; i < GROUP_SIZE; i++) {
+		if (ctrl[i] == value) mask |= 1u << i;
+	}
+
+	return mask;
+}
+
+static inline uint32_t group_match_free(const int8_t *ctrl) {
+	uint32_t mask = 0;
+
+	for (int i = 0; i < GROUP_SIZE; i++) {
+		if (ctrl[i] < 0) mask |= 1u << i;
+	}
+
+	return mask;
+}
+
+#endif
+
+/*
+ * Returns the control byte of an entity with the given hash (its lowest 7 bits)
+ */
+static inline int8_t hash_ctrl(uint64_t hash) {
+	return (int8_t) (hash & 0x7F);
+}
+
+/*
+ * Given an HashSlots, an index and a control byte,
+ * sets the control byte of the slot, and its copy at the end if it's in the first group
+ */
+static inline void set_ctrl(HashSlots *hs, unsigned long index, int8_t value) {
+	hs->ctrl[index] = value;
+
+	if (index < GROUP_SIZE) {
+		hs->ctrl[hs->size + index] = value;
+	}
+}
+
+/*
+ * Given an HashSlots, a string and its hash,
+ * returns the index of the slot with the corresponding entity_t, -1 if not present
+ *
+ * Groups are probed at increasing distances (1, 2, 3... groups) from the one of the hash
+ */
+long slots_find(HashSlots *hs, Slice to_hash, uint64_t hash) {
+	unsigned long 	mask = hs->size - 1, index = (hash >> 7) & mask;
+	uint32_t 	match;
+	entity_t 	*ent;
+
+	for (unsigned long probe = 1; ; probe++) {
+		//The slots of the group are loaded while the control bytes are compared
+		__builtin_prefetch(hs->slots + index);
+
+		match = group_match(hs->ctrl + index, hash_ctrl(hash));
+
+		//Compares the full hash, then the ID, only of the slots with the same control byte
+		while (match != 0) {
+			ent = hs->slots[(index + __builtin_ctz(match)) & mask];
+
+			if (ent->hash == hash && ent->id_length == to_hash.length && memcmp(ent->id, to_hash.start, to_hash.length) == 0) {
+				return (index + __builtin_ctz(match)) & mask;
+			}
+
+			match &= match - 1;
+		}
+
+		//An empty slot means that the probing for this hash ended here when inserting
+		if (group_match(hs->ctrl + index, CTRL_EMPTY) != 0 || probe > hs->size / GROUP_SIZE) return -1;
+
+		index = (index + probe * GROUP_SIZE) & mask;
+	}
+}
+
+/*
+ * Given an HashSlots, an entity_t and its hash,
+ * puts the entity_t in the first empty or deleted slot of the probing sequence of the hash
+ *
+ * There must be at least one free slot
+ */
+void slots_insert(HashSlots *hs, entity_t *ent, uint64_t hash) {
+	unsigned long 	mask = hs->size - 1, index = (hash >> 7) & mask;
+	uint32_t 	match;
+
+	//The slot is most likely the first of the group, it's loaded while the control bytes are compared
+	__builtin_prefetch(hs->slots + index, 1);
+	__builtin_prefetch(hs->hashes + index, 1);
+
+	for (unsigned long probe = 1; (match = group_match_free(hs->ctrl + index)) == 0; probe++) {
+		index = (index + probe * GROUP_SIZE) & mask;
+	}
+
+	index = (index + __builtin_ctz(match)) & mask;
+
+	//Deleted slots are already counted as used
+	if (hs->ctrl[index] == CTRL_EMPTY) hs->used++;
+
+	set_ctrl(hs, index, hash_ctrl(hash));
+	hs->slots[index] = ent;
+	hs->hashes[index] = hash >> 7;
+}
+
+/*
+ * Given an HashTable,
+ * moves up to HASH_REHASH_STEP groups of slots from the old table to the new one,
+ * freeing the old table when all slots have been moved
+ *
+ * Moved slots are marked as deleted, so that searches in the old table still go past them
+ *
+ * Does nothing if the table is not growing
+ */
+void hash_rehash_step(HashTable *ht) {
+	HashSlots *old = &ht->old_table;
+
+	if (old->ctrl == NULL) return;
+
+	for (int i = 0; i < HASH_REHASH_STEP * GROUP_SIZE && ht->rehash_index < old->size; i++) {
+		//The hash is put back together from the slot, so the entity is not read
+		if (old->ctrl[ht->rehash_index] >= 0) {
+			slots_insert(&ht->table, old->slots[ht->rehash_index], (uint64_t) old->hashes[ht->rehash_index] << 7 | old->ctrl[ht->rehash_index]);
+			set_ctrl(old, ht->rehash_index, CTRL_DELETED);
+		}
+
+		ht->rehash_index++;
+	}
+
+	if (ht->rehash_index == old->size) {
+		free(old->ctrl);
+		free(old->slots);
+		free(old->hashes);
+		old->ctrl = NULL;
+	}
+}
+
+/*
+ * Given an HashTable,
+ * starts moving its entities to new slots if more than HASH_MAX_LOAD eighths of them are used
+ *
+ * The new table has double the slots, or the same number if most of the used
+ * slots are of deleted entities. If the table is already growing, finishes moving the old one first
+ */
+void hash_grow(HashTable *ht) {
+	unsigned long size = ht->table.size;
+
+	if (ht->table.used * 8 <= size * HASH_MAX_LOAD) return;
+
+	while (ht->old_table.ctrl != NULL) {
+		hash_rehash_step(ht);
+	}
+
+	if (ht->count * 16 > size * HASH_MAX_LOAD) {
+		size *= 2;
+	}
+
+	ht->old_table = ht->table;
+	ht->rehash_index = 0;
+
+	init_slots(&ht->table, size);
+}
+
+/*
+ * Given an engine, its HashTable and a function,
+ * calls the function on every entity in the table
+ *
+ * The function can free the entity_t it is given
+ */
+void hash_foreach(Engine *engine, HashTable *ht, void (*function)(Engine *, entity_t *)) {
+	for (unsigned long i = 0; i < ht->table.size; i++) {
+		if (ht->table.ctrl[i] >= 0) function(engine, ht->table.slots[i]);
+	}
+
+	if (ht->old_table.ctrl == NULL) return;
+
+	for (unsigned long i = ht->rehash_index; i < ht->old_table.size; i++) {
+		if (ht->old_table.ctrl[i] >= 0) function(engine, ht->old_table.slots[i]);
+	}
+}
+
+/*
+ * Given an empty HashTable and the expected number of entities,
+ * replaces its slots with enough slots to store them without growing
+ */
+void hash_reserve(HashTable *ht, unsigned long expected) {
+	unsigned long size = table_size(expected);
+
+	if (ht->count > 0 || ht->old_table.ctrl != NULL || size <= ht->table.size) return;
+
+	free(ht->table.ctrl);
+	free(ht->table.slots);
+	free(ht->table.hashes);
+
+	init_slots(&ht->table, size);
+}
+
+/*
+ * Prints the given HashTable
+ *
+ * Only used for debugging
+ */
+void print_hash(HashTable *ht) {
+	for (unsigned long i = 0; i < ht->table.size; i++) {
+		if (ht->table.ctrl[i] < 0) continue;
+
+		printf("%lu: \t\t%.*s\n", i, ht->table.slots[i]->id_length, ht->table.slots[i]->id);
+	}
+}
+
+/*
+ * Prints on stderr the number of entities, the used slots and the longest and average number
+ * of groups probed to find an entity of the given HashTable
+ *
+ * Printed with -s, 'benchmarks/hash_distribution.sh' uses it to check the distribution of 'hash_string'.
+ * Only the new table is visited while the table is growing
+ */
+void print_hash_distribution(HashTable *ht) {
+	HashSlots 	*hs = &ht->table;
+	unsigned long 	mask = hs->size - 1, entities = 0, longest = 0, total = 0, probe, index;
+
+	for (unsigned long i = 0; i < hs->size; i++) {
+		if (hs->ctrl[i] < 0) continue;
+
+		//Follows the probing sequence until the group containing the slot
+		index = (hs->slots[i]->hash >> 7) & mask;
+
+		for (probe = 1; ((i - index) & mask) >= GROUP_SIZE; probe++) {
+			index = (index + probe * GROUP_SIZE) & mask;
+		}
+
+		if (probe > longest) longest = probe;
+
+		total += probe;
+		entities++;
+	}
+
+	fprintf(stderr, "hash table: %lu entities, %lu/%lu used slots, longest probe %lu groups, average probe %.2f groups\n",
+		entities, hs->used, hs->size, longest, entities > 0 ? (double) total / entities : 0.0);
+}
+
+/*
+ * Given a character,
+ * returns its 6 bit code: IDs are made of '-', digits, uppercase letters, '_' and lowercase letters,
+ * that's 64 characters, numbered in ASCII order. Returns 64 for any other character
+ */
+static inline unsigned int char_code(unsigned char c) {
+	if (c == '-') return 0;
+	if (c >= '0' && c <= '9') return 1 + c - '0';
+	if (c >= 'A' && c <= 'Z') return 11 + c - 'A';
+	if (c == '_') return 37;
+	if (c >= 'a' && c <= 'z') return 38 + c - 'a';
+
+	return 64;
+}
+
+/*
+ * Given an ID,
+ * packs the codes of its first PREFIX_CHARS characters in the lowest 60 bits of a number, the first character in the highest ones
+ *
+ * Shorter IDs are completed with code 0, so if the prefixes of two IDs are different,
+ * they are in the same order of the IDs, if they are equal the whole IDs need to be compared.
+ * Returns PREFIX_NONE if one of the characters has no code, then the whole IDs are always compared
+ */
+static inline uint64_t id_prefix(Slice id) {
+	uint64_t 	prefix = 0;
+	unsigned int 	i, code;
+
+	for (i = 0; i < PREFIX_CHARS && i < id.length; i++) {
+		if ((code = char_code(id.start[i])) == 64) return PREFIX_NONE;
+
+		prefix = prefix << 6 | code;
+	}
+
+	return prefix << 6 * (PREFIX_CHARS - i);
+}
+
+/*
+ * Given an engine, its HashTable and a string,
+ * creates a new entity_t, puts it into the HashTable and returns it
+ *
+ * Does not check if the entity is already present, so 'hash_search' needs to be called first
+ */
+entity_t *hash_insert(Engine *engine, HashTable *ht, Slice to_hash) {
+	uint64_t 	hash = hash_string(to_hash.start, to_hash.length);
+	entity_t 	*new;
+	char 		*quoted;
+
+	//The slots of the entity are loaded while it's initialized
+
+	//Allocs memory for the new node and initializes the variables
+	new = pool_alloc(&engine->entity_pool);
+
+	//Stores the ID between double quotes and followed by a space, as it's printed
+	quoted = to_hash.length + 3 <= ENTITY_QUOTED_ID ? new->quoted : malloc(to_hash.length + 3);
+
+	quoted[0] = '\"';
+	memcpy(quoted + 1, to_hash.start, to_hash.length);
+	quoted[to_hash.length + 1] = '\"';
+	quoted[to_hash.length + 2] = ' ';
+
+	new->hash = hash;
+	new->id = quoted + 1;
+	new->id_length = to_hash.length;
+	new->prefix = id_prefix(to_hash);
+
+	for (unsigned int i = 0; i < engine->set_shards; i++) {
+		new->shards[i] = (SetShard) { NULL, 0, 0, false };
+	}
+
+	index_acquire(&engine->indices, new);
+
+	hash_rehash_step(ht);
+
+	//Always inserted in the new table
+	slots_insert(&ht->table, new, new->hash);
+
+	ht->count++;
+	hash_grow(ht);
+
+	return new;
+}
+
+/*
+ * Given a string
+ * returns the corresponding entity_t from the HashTable, NULL if not present
+ *
+ * Looks into the old table as well if the table is growing
+ */
+entity_t *hash_search(HashTable *ht, Slice to_hash) {
+	uint64_t 	hash = hash_string(to_hash.start, to_hash.length);
+	long 		index;
+
+	hash_rehash_step(ht);
+
+	if ((index = slots_find(&ht->table, to_hash, hash)) != -1) {
+		return ht->table.slots[index];
+	}
+
+	if (ht->old_table.ctrl != NULL && (index = slots_find(&ht->old_table, to_hash, hash)) != -1) {
+		return ht->old_table.slots[index];
+	}
+
+	return NULL;
+}
+
+/*
+ * Given an engine and one of its entities,
+ * frees all the memory allocated for the entity
+ */
+void free_entity(Engine *engine, entity_t *todelete) {
+	SetShard *shard;
+
+	for (unsigned int i = 0; i < engine->set_shards; i++) {
+		shard = &todelete->shards[i];
+
+		for (uint32_t j = 0; j < shard->capacity; j++) {
+			clear_set(&shard->slots[j].in);
+			clear_set(&shard->slots[j].out);
+		}
+
+		free(shard->slots);
+	}
+
+	if (todelete->id - 1 != todelete->quoted) free(todelete->id - 1);
+	pool_free(&engine->entity_pool, todelete);
+}
+
+/*
+ * Given an engine, its HashTable and an entity_t of the HashTable,
+ * deletes it from the table and frees it
+ *
+ * The entity_t needs to be found beforehand with 'hash_search'
+ */
+void hash_delete(Engine *engine, HashTable *ht, entity_t *todelete) {
+	Slice 		id = { todelete->id, todelete->id_length };
+	HashSlots 	*hs = &ht->table;
+	long 		index;
+
+	hash_rehash_step(ht);
+
+	if ((index = slots_find(hs, id, todelete->hash)) == -1) {
+		hs = &ht->old_table;
+
+		//Not actually possible since the entity_t is in the table
+		if (hs->ctrl == NULL || (index = slots_find(hs, id, todelete->hash)) == -1) return;
+	}
+
+	//The slot stays used, so that the probing of other entities goes past it
+	set_ctrl(hs, index, CTRL_DELETED);
+
+	ht->count--;
+
+	//The index is given to the next inserted entity
+	index_release(&engine->indices, hs->slots[index]);
+
+	//Frees all memory
+	free_entity(engine, hs->slots[index]);
+}
+
+/*
+ * Iteratively frees every memory allocated in the hash table entries, and the tables
+ */
+void clear_hash_table(Engine *engine, HashTable *ht) {
+	hash_foreach(engine, ht, free_entity);
+
+	free(ht->table.ctrl);
+	free(ht->table.slots);
+	free(ht->table.hashes);
+
+	if (ht->old_table.ctrl != NULL) {
+		free(ht->old_table.ctrl);
+		free(ht->old_table.slots);
+		free(ht->old_table.hashes);
+	}
+}
+
+/************************/
+/*		RB FUNCTIONS	*/
+/************************/
+
+/*
+ * Given two entities,
+ * compares their IDs in alphabetic order, like 'strcmp'
+ *
+ * The packed prefixes are compared first, the IDs only if they are equal or one of them is PREFIX_NONE
+ */
+static inline int compare_ids(entity_t *a, entity_t *b) {
+#ifndef COMPARE_MEMCMP
+	if (a->prefix != b->prefix && (a->prefix | b->prefix) >> 60 == 0) return a->prefix < b->prefix ? -1 : 1;
+#endif
+
+	int compare = memcmp(a->id, b->id, a->id_length < b->id_length ? a->id_length : b->id_length);
+
+	return compare != 0 ? compare : (int) a->id_length - (int) b->id_length;
+}
+
+/*
+ * Given a Forest and an entity_t,
+ * allocates memory for a new node from the pool of the Forest and returns it
+ */
+node *init_node(Forest *forest, entity_t *to) {
+	node *z = pool_alloc(&forest->node_pool);
+
+	//inserts arguments
+	z->to = to;
+	z->left = forest->nil;
+	z->right = forest->nil;
+	z->color = RED;
+
+	return z;
+}
+
+/*
+ * Util function to initialize the NIL node of an engine
+ */
+void init_nil(node *nil) {
+	nil->p = nil;
+	nil->right = nil;
+	nil->left = nil;
+	nil->color = BLACK;
+}
+
+/*
+ * Given a node,
+ * returns the minimum
+ */
+node *tree_min(Forest *forest, node *x) {
+	while (x->left != forest->nil)
+		x = x->left;
+
+	return x;
+}
+
+/*
+ * Given a node,
+ * returns the maximum
+ */
+node *tree_max(Forest *forest, node *x) {
+	while (x->right != forest->nil)
+		x = x->right;
+
+	return x;
+}
+
+/*
+ * Given a node,
+ * returns the successor in the Tree
+ */
+node *tree_successor(Forest *forest, node *x) {
+	if (x->right != forest->nil)
+		return tree_min(forest, x->right);
+
+	node *y = x->p;
+
+	while (y != forest->nil && x == y->right) {
+		x = y;
+		y = y->p;
+	}
+
+	return y;
+}
+
+/*
+ * Given a node,
+ * returns the predecessor in the Tree
+ */
+node *tree_predecessor(Forest *forest, node *x) {
+	if (x->left != forest->nil)
+		return tree_max(forest, x->left);
+
+	node *y = x->p;
+
+	while (y != forest->nil && x == y->left) {
+		x = y;
+		y = y->p;
+	}
+
+	return y;
+}
+
+/*
+ * Recursively frees in post-order all the nodes of the given tree
+ * 'first' is used to reinitialize the tree only once
+ */
+void clear_tree(Forest *forest, Tree *tree, node *root, bool first) {
+	if (root != forest->nil) {
+		clear_tree(forest, tree, root->left, false);
+		clear_tree(forest, tree, root->right, false);
+
+		pool_free(&forest->node_pool, root);
+
+		//Executed once thanks to 'first' parameter
+		if (first) {
+			tree->root = forest->nil;
+			tree->size = 0;
+		}
+	}
+}
+
+/*
+ * Given a Tree and a node,
+ * performs a RB-Tree left rotation
+ */
+void left_rotate(Forest *forest, Tree *tree, node *x) {
+	node *y;
+
+	y = x->right;
+	x->right = y->left;
+
+	if (y->left != forest->nil) {
+		y->left->p = x;
+	}
+
+	y->p = x->p;
+
+	if (x->p == forest->nil) {
+		tree->root = y;
+	} else if (x == x->p->left) {
+		x->p->left = y;
+	} else {
+		x->p->right = y;
+	}
+
+	y->left = x;
+	x->p = y;
+}
+
+/*
+ * Given a Tree and a node,
+ * performs a RB-Tree right rotation
+ */
+void right_rotate(Forest *forest, Tree *tree, node *x) {
+	node *y;
+
+	y = x->left;
+	x->left = y->right;
+
+	if (y->right != forest->nil) {
+		y->right->p = x;
+	}
+
+	y->p = x->p;
+	if (x->p == forest->nil) {
+		tree->root = y;
+	} else if (x == x->p->right) {
+		x->p->right = y;
+	} else {
+		x->p->left = y;
+	}
+
+	y->right = x;
+	x->p = y;
+}
+
+/*
+ * Given a tree and a node,
+ * rebalances the RB-Tree after insertion
+ */
+void rb_insert_fixup(Forest *forest, Tree *tree, node *z) {
+	node *y;
+
+	while (z->p->color == RED) {
 		if (z->p == z->p->p->left) {
 			y = z->p->p->right;
 
@@ -1025,289 +3639,1240 @@ void rb_insert_fixup(Tree *tree, node *z) {
 			} else if (z == z->p->right) {
 				//Case 2
 				z = z->p;
-				left_rotate(tree, z);
+				left_rotate(forest, tree, z);
 			} else {
 				//Case 3
 				z->p->color = BLACK;
 				z->p->p->color = RED;
-				right_rotate(tree, z->p->p);
+				right_rotate(forest, tree, z->p->p);
+			}
+		} else {
+			y = z->p->p->left;
+
+			if (y->color == RED) {
+				//Case 1
+				z->p->color = BLACK;
+				y->color = BLACK;
+				z->p->p->color = RED;
+				z = z->p->p;
+			} else if (z == z->p->left) {
+				//Case 2
+				z = z->p;
+				right_rotate(forest, tree, z);
+			} else {
+				//Case 3
+				z->p->color = BLACK;
+				z->p->p->color = RED;
+				left_rotate(forest, tree, z->p->p);
+			}
+		}
+	}
+
+	tree->root->color = BLACK;
+}
+
+/*
+ * Given a tree, a node and its parent,
+ * rebalances the RB-Tree after deletion
+ *
+ * The parent is passed because the node can be NIL, whose parent is never written
+ */
+void rb_delete_fixup(Forest *forest, Tree *tree, node *x, node *parent) {
+	node *w = forest->nil;
+
+	while (x != tree->root && x->color == BLACK) {
+		if (x == parent->left) {
+			w = parent->right;
+
+			if (w->color == RED) {
+				w->color = BLACK;
+				parent->color = RED;
+				left_rotate(forest, tree, parent);
+				w = parent->right;
+			}
+
+			if (w->left->color == BLACK && w->right->color == BLACK) {
+				//Case 1
+				w->color = RED;
+				x = parent;
+				parent = x->p;
+			} else if (w->right->color == BLACK) {
+				//Case 2
+				w->left->color = BLACK;
+				w->color = RED;
+				right_rotate(forest, tree, w);
+				w = parent->right;
+			} else {
+				//Case 3
+				w->color = parent->color;
+				parent->color = BLACK;
+				w->right->color = BLACK;
+				left_rotate(forest, tree, parent);
+				x = tree->root;
+			}
+		} else {
+			w = parent->left;
+
+			if (w->color == RED) {
+				w->color = BLACK;
+				parent->color = RED;
+				right_rotate(forest, tree, parent);
+				w = parent->left;
+			}
+
+			if (w->right->color == BLACK && w->left->color == BLACK) {
+				//Case 1
+				w->color = RED;
+				x = parent;
+				parent = x->p;
+			} else if (w->left->color == BLACK) {
+				//Case 2
+				w->right->color = BLACK;
+				w->color = RED;
+				left_rotate(forest, tree, w);
+				w = parent->left;
+			} else {
+				//Case 3
+				w->color = parent->color;
+				parent->color = BLACK;
+				w->left->color = BLACK;
+				right_rotate(forest, tree, parent);
+				x = tree->root;
 			}
+		}
+	}
+
+	if (x != forest->nil) {
+		x->color = BLACK;
+	}
+}
+
+/*
+ * Given a Tree and an entity_t,
+ * creates a new node, inserts it into the tree and returns the node itself
+ *
+ * If necessary, rebalances the tree with 'rb_insert_fixup'
+ */
+node *rb_insert(Forest *forest, Tree *tree, entity_t *to) {
+	node 	*x, *y;
+	node 	*z = init_node(forest, to);
+
+	y = forest->nil;
+	x = tree->root;
+
+	while (x != forest->nil) {
+		y = x;
+
+		//Goes left or right checking alphabetic order
+		if (z->to->label < x->to->label) {
+			x = x->left;
 		} else {
-			y = z->p->p->left;
+			x = x->right;
+		}
+	}
+
+	z->p = y;
+
+	if (y == forest->nil) {
+		tree->root = z;
+		tree->root->color = BLACK;
+	} else {
+
+		//Inserts left or right checking alphabetic order
+		if (z->to->label < y->to->label)
+			y->left = z;
+		else
+			y->right = z;
+	}
+
+	//Increments tree size
+	tree->size = tree->size + 1;
+
+	//Rebalances the Tree
+	rb_insert_fixup(forest, tree, z);
+
+	return z;
+}
+
+/*
+ * Given a Tree and a node,
+ * deletes the given node
+ */
+void rb_delete(Forest *forest, Tree *tree, node *z) {
+	node *x, *y, *x_parent;
+
+	if (z->left == forest->nil || z->right == forest->nil) {
+		y = z;
+	} else {
+		y = tree_successor(forest, z);
+	}
+
+	if (y->left != forest->nil) {
+		x = y->left;
+	} else {
+		x = y->right;
+	}
+
+	//NIL is shared, its parent is passed to 'rb_delete_fixup' instead of being written
+	x_parent = y->p;
+
+	if (x != forest->nil) {
+		x->p = y->p;
+	}
+
+	if (y->p == forest->nil) {
+		tree->root = x;
+	} else if (y == y->p->left) {
+		y->p->left = x;
+	} else {
+		y->p->right = x;
+	}
+
+	if (y != z) {
+		z->to = y->to;
+	}
+
+	//Rebalances the Tree if needed
+	if (y->color == BLACK) {
+		rb_delete_fixup(forest, tree, x, x_parent);
+	}
+
+	//Decrements the size of the Tree
+	tree->size = tree->size - 1;
+
+	pool_free(&forest->node_pool, y);
+}
+
+/*
+ * Given a node (root) and an entity_t,
+ * recursively returns the corresponding node if present, NIL otherwise
+ */
+node *tree_search(Forest *forest, node *x, entity_t *to) {
+	//Case Tree is empty or entity_t is NULL
+	if (x == forest->nil || to == NULL) return x;
+
+	node 	*toReturn;
+
+	//Case found, the labels are compared instead of the IDs
+	if (to->label == x->to->label) {
+		toReturn = x;
+	} else if (to->label < x->to->label) { //Left or right otherwise
+		toReturn = tree_search(forest, x->left, to);
+	} else {
+		toReturn = tree_search(forest, x->right, to);
+	}
+
+	return toReturn;
+}
+
+/*
+ * Given an array of entities sorted by ID, their number, the parent of the subtree,
+ * its depth and the depth of the last level of the whole tree,
+ * recursively builds a balanced subtree with all the entities and returns its root
+ */
+static node *build_subtree(Forest *forest, entity_t **sorted, unsigned long count, node *parent, unsigned int depth, unsigned int last) {
+	if (count == 0) return forest->nil;
+
+	unsigned long 	middle = count / 2;
+	node 		*x = init_node(forest, sorted[middle]);
+
+	//Only the last level is red, so every path has the same number of black nodes
+	x->p = parent;
+	x->color = depth == last ? RED : BLACK;
+	x->left = build_subtree(forest, sorted, middle, x, depth + 1, last);
+	x->right = build_subtree(forest, sorted + middle + 1, count - middle - 1, x, depth + 1, last);
+
+	return x;
+}
+
+/*
+ * Given an empty Tree, an array of entities sorted by ID and their number,
+ * builds the whole tree at once, without comparing the IDs or rebalancing
+ *
+ * Used to load a checkpoint
+ */
+void tree_build(Forest *forest, Tree *tree, entity_t **sorted, unsigned long count) {
+	unsigned int last = 0;
+
+	if (count == 0) return;
+
+	//Depth of the last level: the two halves of every subtree differ by one entity at most
+	while ((2ul << last) <= count) last++;
+
+	tree->root = build_subtree(forest, sorted, count, forest->nil, 0, last);
+	tree->root->color = BLACK;
+	tree->size = count;
+}
+
+/*
+ * Util function to initialize a Tree, allocated from the pool of the given Forest
+ */
+Tree *init_tree(Forest *forest) {
+	Tree *tree = pool_alloc(&forest->tree_pool);
+	tree->root = forest->nil;
+	tree->size = 0;
+
+	return tree;
+}
+
+/*
+ * Given a node (root) and a Buffer,
+ * recursively copies the IDs in the Buffer, in alphabetic order
+ */
+void render_relation_tree(Forest *forest, node *root, Buffer *rendered) {
+	if (root != forest->nil) {
+		render_relation_tree(forest, root->left, rendered);
+
+		//The ID is stored with the double quotes and the space around it
+		buffer_bytes(rendered, root->to->id - 1, root->to->id_length + 3);
+
+		render_relation_tree(forest, root->right, rendered);
+	}
+}
+
+/*
+ * Prints a given Tree
+ *
+ * Only used for debugging, space is set to 0 on the first call
+ */
+void print_tree(Forest *forest, node * root, int space) {
+	if (root == forest->nil) return;
+
+	space += 20;
+
+	if (root->right != forest->nil)
+		print_tree(forest, root->right, space);
+
+	printf("\n");
+
+	for (int i = 20; i < space; i++)
+		printf(" ");
+
+	printf("%.*s\n", root->to->id_length, root->to->id);
+
+	if (root->left != forest->nil)
+		print_tree(forest, root->left, space);
+}
+
+/****************************/
+/*	LABEL FUNCTIONS     */
+/****************************/
+
+/*
+ * The trees are sorted by ID, but comparing two IDs means reading both strings.
+ * So every entity has a 64 bit label, and the labels are kept in the same order of the IDs:
+ * the trees compare the labels instead, without reading the IDs.
+ *
+ * All the entities are kept in alphabetic order in the 'order' tree of the engine.
+ * A new entity gets a label between the ones of the previous and the next entity in the tree,
+ * if they are consecutive, the labels of the closest entities are spread evenly in a range large enough
+ */
+
+/*
+ * Given an engine and the node of an entity just inserted in the order tree,
+ * gives the entity a label between the ones of the previous and the next entity
+ *
+ * If the labels around are consecutive, the range of labels relabeled grows one entity on both sides
+ * until the labels can be spread evenly with gaps at least as large as the number of entities in the range.
+ * Worker threads compare the labels, so they are waited for before relabeling
+ */
+static void order_label(Engine *engine, node *z) {
+	Forest 		*forest = &engine->forest;
+	node 		*first = z, *last = z;
+	node 		*before = tree_predecessor(forest, z), *after = tree_successor(forest, z);
+	uint64_t 	low = before != forest->nil ? before->to->label : 0;
+	uint64_t 	high = after != forest->nil ? after->to->label : UINT64_MAX;
+	uint64_t 	gap, label;
+	unsigned long 	count = 1;
+
+	if (high - low >= 2) {
+		//Entities added in alphabetic order leave room for the next ones instead of halving it every time
+		if (after == forest->nil && high - low > 2 * LABEL_STEP) {
+			z->to->label = low + LABEL_STEP;
+		} else if (before == forest->nil && high - low > 2 * LABEL_STEP) {
+			z->to->label = high - LABEL_STEP;
+		} else {
+			z->to->label = low + (high - low) / 2;
+		}
+
+		return;
+	}
+
+	workers_wait(engine);
+
+	while ((high - low) / (count + 1) < count) {
+		if (before != forest->nil) {
+			first = before;
+			before = tree_predecessor(forest, before);
+			count++;
+		}
+
+		if (after != forest->nil) {
+			last = after;
+			after = tree_successor(forest, after);
+			count++;
+		}
+
+		low = before != forest->nil ? before->to->label : 0;
+		high = after != forest->nil ? after->to->label : UINT64_MAX;
+	}
+
+	gap = (high - low) / (count + 1);
+	label = low;
+
+	for (node *x = first; ; x = tree_successor(forest, x)) {
+		label += gap;
+		x->to->label = label;
+
+		if (x == last) break;
+	}
+}
+
+/*
+ * Given an engine and a new entity_t,
+ * inserts the entity in the order tree comparing the IDs and gives it a label with 'order_label'
+ */
+void order_insert(Engine *engine, entity_t *ent) {
+	Forest 	*forest = &engine->forest;
+	Tree 	*order = &engine->order;
+	node 	*x = order->root, *y = forest->nil;
+	node 	*z = init_node(forest, ent);
+
+	//The new entity has no label yet, so this is the only tree where the IDs are compared
+	while (x != forest->nil) {
+		y = x;
+		x = compare_ids(ent, x->to) < 0 ? x->left : x->right;
+	}
+
+	z->p = y;
+
+	if (y == forest->nil) {
+		order->root = z;
+	} else if (compare_ids(ent, y->to) < 0) {
+		y->left = z;
+	} else {
+		y->right = z;
+	}
+
+	order->size++;
+
+	rb_insert_fixup(forest, order, z);
+
+	order_label(engine, z);
+}
+
+/*
+ * Given an engine without entities in the order tree, the entities sorted by ID and their number,
+ * builds the order tree with all of them at once and spreads their labels evenly
+ *
+ * Used to load a checkpoint
+ */
+void order_build(Engine *engine, entity_t **sorted, unsigned long count) {
+	uint64_t gap = UINT64_MAX / (count + 1);
+
+	for (unsigned long i = 0; i < count; i++) {
+		sorted[i]->label = gap * (i + 1);
+	}
+
+	tree_build(&engine->forest, &engine->order, sorted, count);
+}
+
+/*
+ * Given an engine and an entity_t being deleted,
+ * deletes it from the order tree, the labels of the others don't change
+ */
+void order_delete(Engine *engine, entity_t *ent) {
+	rb_delete(&engine->forest, &engine->order, tree_search(&engine->forest, engine->order.root, ent));
+}
+
+/********************************/
+/*	CHECKPOINT FUNCTIONS	*/
+/********************************/
+
+/*
+ * Given an engine, one of its entities and a type id,
+ * returns the set of its incoming relations of that type, NULL if it has none
+ */
+static inline EntitySet *incoming_relations(Engine *engine, entity_t *ent, unsigned int type_id) {
+	TypeSets *sets = entity_sets(engine, ent, type_id);
+
+	if (sets == NULL || sets->in.count == 0) return NULL;
+
+	return &sets->in;
+}
+
+/*
+ * Given a file and a number,
+ * writes the 32 bits of the number
+ */
+static inline void write_number(FILE *file, uint32_t number) {
+	fwrite(&number, sizeof(number), 1, file);
+}
+
+/*
+ * Given a node (root), the position in alphabetic order of every entity (by dense index) and a file,
+ * recursively writes the positions of the entities in the tree, in alphabetic order
+ */
+static void write_tree(Forest *forest, node *root, uint32_t *alphabetic, FILE *file) {
+	if (root == forest->nil) return;
+
+	write_tree(forest, root->left, alphabetic, file);
+	write_number(file, alphabetic[root->to->index]);
+	write_tree(forest, root->right, alphabetic, file);
+}
+
+/*
+ * Given a node (root), the position in alphabetic order of every entity (by dense index),
+ * an array and the number of positions in it, recursively appends the positions of the entities in the tree
+ */
+static void collect_tree(Forest *forest, node *root, uint32_t *alphabetic, uint32_t *positions, uint32_t *count) {
+	if (root == forest->nil) return;
+
+	collect_tree(forest, root->left, alphabetic, positions, count);
+	positions[(*count)++] = alphabetic[root->to->index];
+	collect_tree(forest, root->right, alphabetic, positions, count);
+}
+
+/*
+ * Given two positions in alphabetic order, compares them for 'qsort'
+ */
+static int compare_positions(const void *a, const void *b) {
+	uint32_t first = *(const uint32_t *) a, second = *(const uint32_t *) b;
+
+	return first < second ? -1 : first > second;
+}
+
+/*
+ * Given an EntitySet, the position in alphabetic order of every entity (by dense index),
+ * an array as big as the set and a file, writes the positions of the entities in the set, sorted
+ */
+static void write_set(EntitySet *set, uint32_t *alphabetic, uint32_t *positions, FILE *file) {
+	uint32_t count = 0, cursor = 0, index;
+
+	while ((index = set_next(set, &cursor)) != SET_EMPTY) {
+		positions[count++] = alphabetic[index];
+	}
+
+	qsort(positions, count, sizeof(uint32_t), compare_positions);
+	fwrite(positions, sizeof(uint32_t), count, file);
+}
+
+/*
+ * CHECKPOINT command
+ *
+ * Writes the whole graph in the file at the given path with 'write_checkpoint'
+ */
+void checkpoint(Engine *engine, Slice path) {
+	char *name;
+
+	if (path.length == 0) return;
+
+	name = strndup(path.start, path.length);
+	write_checkpoint(engine, name);
+	free(name);
+}
+
+/*
+ * Given an engine and a path,
+ * writes the whole graph in the file at the path, in the format described above 'Reader'
+ *
+ * The file is written as '<path>.tmp', synced and renamed when complete,
+ * so a checkpoint that fails halfway never replaces the previous one.
+ * Returns FALSE if the file could not be written
+ */
+bool write_checkpoint(Engine *engine, const char *path) {
+	TypeTable 	*types = engine->types;
+	entity_t 	**sorted;
+	uint32_t 	*alphabetic, *positions, *participants;
+	list_t 		*data_list;
+	Tree 		*tree;
+	EntitySet 	*set;
+	unsigned long 	count;
+	uint64_t 	count_bits;
+	uint32_t 	with_relations = 0, incoming;
+	char 		*temporary;
+	FILE 		*file;
+	bool 		failed;
+
+	//The trees and the maxima are read, so the workers are waited for first
+	workers_barrier(engine);
+
+	temporary = malloc(strlen(path) + 5);
+	sprintf(temporary, "%s.tmp", path);
+
+	if ((file = fopen(temporary, "wb")) == NULL) {
+		perror(temporary);
+		free(temporary);
+		return false;
+	}
+
+	//Entities are referred to by their position in alphabetic order, the one of the order tree
+	sorted = malloc((engine->entities->count + 1) * sizeof(entity_t *));
+	count = 0;
+
+	for (node *x = tree_min(&engine->forest, engine->order.root); x != engine->forest.nil; x = tree_successor(&engine->forest, x)) {
+		sorted[count++] = x->to;
+	}
+
+	alphabetic = malloc((engine->indices.next + 1) * sizeof(uint32_t));
+
+	for (unsigned long i = 0; i < count; i++) {
+		alphabetic[sorted[i]->index] = i;
+	}
+
+	//The sets are not sorted, their positions are sorted here before writing them
+	positions = malloc((count + 1) * sizeof(uint32_t));
+	participants = malloc((count + 1) * sizeof(uint32_t));
+
+	count_bits = count;
+
+	fwrite(CHECKPOINT_MAGIC, 1, 8, file);
+	write_number(file, CHECKPOINT_VERSION);
+	fwrite(&engine->log.generation, sizeof(engine->log.generation), 1, file);
+	write_number(file, types->count);
+	fwrite(&count_bits, sizeof(count_bits), 1, file);
+
+	for (unsigned int id = 0; id < types->count; id++) {
+		write_number(file, strlen(types->names[id]));
+		fwrite(types->names[id], 1, strlen(types->names[id]), file);
+
+		if (types->data[id] != NULL) with_relations++;
+	}
 
-			if (y->color == RED) {
-				//Case 1
-				z->p->color = BLACK;
-				y->color = BLACK;
-				z->p->p->color = RED;
-				z = z->p->p;
-			} else if (z == z->p->left) {
-				//Case 2
-				z = z->p;
-				right_rotate(tree, z);
-			} else {
-				//Case 3
-				z->p->color = BLACK;
-				z->p->p->color = RED;
-				left_rotate(tree, z->p->p);
+	for (unsigned long i = 0; i < count; i++) {
+		write_number(file, sorted[i]->id_length);
+		fwrite(sorted[i]->id, 1, sorted[i]->id_length, file);
+	}
+
+	write_number(file, with_relations);
+
+	for (unsigned int id = 0; id < types->count; id++) {
+		if ((data_list = types->data[id]) == NULL) continue;
+
+		//The reported entities
+		tree = data_list->degrees[data_list->current_maximum];
+
+		write_number(file, id);
+		write_number(file, data_list->current_maximum);
+		write_number(file, tree->size);
+		write_tree(&engine->forest, tree->root, alphabetic, file);
+
+		//The entities with incoming relations are the ones in the trees of 'degrees', the other ones are not visited
+		incoming = 0;
+
+		for (uint64_t degree = 1; degree <= data_list->current_maximum; degree++) {
+			if (data_list->degrees[degree] != NULL) {
+				collect_tree(&engine->forest, data_list->degrees[degree]->root, alphabetic, participants, &incoming);
 			}
 		}
+
+		qsort(participants, incoming, sizeof(uint32_t), compare_positions);
+
+		write_number(file, incoming);
+
+		for (uint32_t i = 0; i < incoming; i++) {
+			set = incoming_relations(engine, sorted[participants[i]], id);
+
+			write_number(file, participants[i]);
+			write_number(file, set->count);
+			write_set(set, alphabetic, positions, file);
+		}
 	}
 
-	tree->root->color = BLACK;
+	//The last bytes are written by 'fflush', the file is on disk before replacing the previous one
+	failed = fflush(file) != 0 || ferror(file) != 0 || fsync(fileno(file)) != 0;
+	failed |= fclose(file) != 0;
+	failed = failed || rename(temporary, path) != 0;
+
+	if (failed) {
+		perror(path);
+		remove(temporary);
+	}
+
+	free(sorted);
+	free(alphabetic);
+	free(positions);
+	free(participants);
+	free(temporary);
+
+	return !failed;
 }
 
 /*
- * Given a tree and a node,
- * rebalances the RB-Tree after deletion
+ * Given a Reader,
+ * reads a 32 bit number, 0 if the file is over
  */
-void rb_delete_fixup(Tree *tree, node *x) {
-	node *w = NIL;
+static inline uint32_t read_number(Reader *reader) {
+	uint32_t number = 0;
 
-	while (x != tree->root && x->color == BLACK) {
-		if (x == x->p->left) {
-			w = x->p->right;
+	if (reader->end - reader->cursor < (long) sizeof(number)) {
+		reader->failed = true;
+		return 0;
+	}
 
-			if (w->color == RED) {
-				w->color = BLACK;
-				x->p->color = RED;
-				left_rotate(tree, x->p);
-				w = x->p->right;
-			}
+	memcpy(&number, reader->cursor, sizeof(number));
+	reader->cursor += sizeof(number);
 
-			if (w->left->color == BLACK && w->right->color == BLACK) {
-				//Case 1
-				w->color = RED;
-				x = x->p;
-			} else if (w->right->color == BLACK) {
-				//Case 2
-				w->left->color = BLACK;
-				w->color = RED;
-				right_rotate(tree, w);
-				w = x->p->right;
-			} else {
-				//Case 3
-				w->color = x->p->color;
-				x->p->color = BLACK;
-				w->right->color = BLACK;
-				left_rotate(tree, x->p);
-				x = tree->root;
-			}
-		} else {
-			w = x->p->left;
+	return number;
+}
 
-			if (w->color == RED) {
-				w->color = BLACK;
-				x->p->color = RED;
-				right_rotate(tree, x->p);
-				w = x->p->left;
-			}
+/*
+ * Given a Reader and a number of characters,
+ * returns a pointer to the characters and skips them, NULL if the file is over
+ */
+static inline const char *read_chars(Reader *reader, size_t length) {
+	const char *chars = reader->cursor;
 
-			if (w->right->color == BLACK && w->left->color == BLACK) {
-				//Case 1
-				w->color = RED;
-				x = x->p;
-			} else if (w->left->color == BLACK) {
-				//Case 2
-				w->right->color = BLACK;
-				w->color = RED;
-				left_rotate(tree, w);
-				w = x->p->left;
-			} else {
-				//Case 3
-				w->color = x->p->color;
-				x->p->color = BLACK;
-				w->left->color = BLACK;
-				right_rotate(tree, x->p);
-				x = tree->root;
-			}
-		}
+	if ((size_t) (reader->end - reader->cursor) < length) {
+		reader->failed = true;
+		return NULL;
 	}
 
-	x->color = BLACK;
+	reader->cursor += length;
+
+	return chars;
 }
 
 /*
- * Given a Tree and an entity_t,
- * creates a new node, inserts it into the tree and returns the node itself
+ * Given an engine, a Reader at the start of the relations of a type, the entities of the checkpoint
+ * sorted by ID, their number and two arrays of 'count' elements used as scratch space ('outgoing' all 0),
+ * fills all the sets and builds the report data of the type
  *
- * If necessary, rebalances the tree with 'rb_insert_fixup'
+ * The relations are read twice: the first time to check them and count the outgoing ones of every entity,
+ * the second time to fill the sets, all of them already grown to their final size.
+ * Only the entities with relations of the type are visited, 'outgoing' is left with all 0 for the next type.
+ * Returns FALSE if the relations are not valid
  */
-node *rb_insert(Tree *tree, entity_t *to) {
-	node 	*x, *y;
-	node 	*z = init_node(to);
+static bool load_type(Engine *engine, Reader *reader, entity_t **entities, unsigned long count, uint32_t *outgoing, uint32_t *sources) {
+	Forest 		*forest = &engine->forest;
+	TypeTable 	*types = engine->types;
+	list_t 		*data_list;
+	Reader 		leaders_reader, relations;
+	EntitySet 	*in_set;
+	entity_t 	**by_degree;
+	uint32_t 	*tos, *degree_end;
+	uint32_t 	type_id, maximum, leaders, incoming, to, from = 0, size, leader = 0, found = 0, previous, sources_count = 0;
+	unsigned long 	start;
+	bool 		valid = true;
 
-	y = NIL;
-	x = tree->root;
+	type_id = read_number(reader);
+	maximum = read_number(reader);
+	leaders = read_number(reader);
 
-	while (x != NIL) {
-		y = x;
+	//The reported entities are checked once all the sets are filled
+	leaders_reader = *reader;
+	read_chars(reader, (size_t) leaders * sizeof(uint32_t));
 
-		//Goes left or right checking alphabetic order
-		if (strcmp(z->to->id, x->to->id) < 0) {
-			x = x->left;
-		} else {
-			x = x->right;
+	incoming = read_number(reader);
+
+	if (reader->failed || type_id >= types->count || types->data[type_id] != NULL || maximum == 0 || incoming == 0 || incoming > count) return false;
+
+	data_list = list_insert(engine, engine->relation_types, types->names[type_id]);
+	data_list->type_id = type_id;
+	types->data[type_id] = data_list;
+
+	tos = malloc(incoming * sizeof(uint32_t));
+
+	relations = *reader;
+
+	//Incoming relations, counting the outgoing ones of every entity
+	for (uint32_t i = 0; i < incoming && valid; i++) {
+		to = read_number(reader);
+		size = read_number(reader);
+
+		valid = !reader->failed && to < count && (i == 0 || to > tos[i - 1]) && size > 0 && size <= maximum;
+
+		for (uint32_t j = 0; j < size && valid; j++) {
+			previous = from;
+			from = read_number(reader);
+
+			valid = !reader->failed && from < count && (j == 0 || from > previous);
+
+			//The first relation of an entity adds it to the sources
+			if (valid && outgoing[from]++ == 0) sources[sources_count++] = from;
 		}
+
+		tos[i] = to;
+
+		if (size > found) found = size;
 	}
 
-	z->p = y;
+	if (!valid || found != maximum) {
+		free(tos);
+		return false;
+	}
 
-	if (y == NIL) {
-		tree->root = z;
-		tree->root->color = BLACK;
-	} else {
+	for (uint32_t i = 0; i < sources_count; i++) {
+		set_reserve(&entity_add_sets(engine, entities[sources[i]], data_list)->out, outgoing[sources[i]], count);
+		entity_shard(engine, entities[sources[i]], type_id)->used = true;
+		outgoing[sources[i]] = 0;
+	}
 
-		//Inserts left or right checking alphabetic order
-		if (strcmp(z->to->id, y->to->id) < 0)
-			y->left = z;
-		else
-			y->right = z;
+	for (uint32_t i = 0; i < incoming; i++) {
+		to = read_number(&relations);
+		size = read_number(&relations);
+
+		in_set = &entity_add_sets(engine, entities[to], data_list)->in;
+		entity_shard(engine, entities[to], type_id)->used = true;
+		set_reserve(in_set, size, count);
+
+		for (uint32_t j = 0; j < size; j++) {
+			from = read_number(&relations);
+
+			set_insert(in_set, entities[from]->index);
+			set_insert(&entity_sets(engine, entities[from], type_id)->out, entities[to]->index);
+		}
 	}
 
-	//Increments tree size
-	tree->size = tree->size + 1;
+	//Report data: the entities are sorted by number of incoming relations, keeping the alphabetic order
+	grow_degrees(data_list, maximum);
 
-	//Rebalances the Tree
-	rb_insert_fixup(tree, z);
+	degree_end = calloc(maximum + 1, sizeof(uint32_t));
+	by_degree = malloc(incoming * sizeof(entity_t *));
 
-	return z;
+	for (uint32_t i = 0; i < incoming; i++) {
+		degree_end[incoming_relations(engine, entities[tos[i]], type_id)->count]++;
+	}
+
+	for (uint32_t degree = 1; degree <= maximum; degree++) {
+		degree_end[degree] += degree_end[degree - 1];
+	}
+
+	//Filled backwards from the end of every part, going through the entities backwards
+	for (uint32_t i = incoming; i > 0; i--) {
+		size = incoming_relations(engine, entities[tos[i - 1]], type_id)->count;
+		by_degree[--degree_end[size]] = entities[tos[i - 1]];
+	}
+
+	//Now 'degree_end' has the start of every part, the end is the start of the next one
+	for (uint32_t degree = 1; degree <= maximum; degree++) {
+		start = degree_end[degree];
+		size = (degree < maximum ? degree_end[degree + 1] : incoming) - start;
+
+		if (size == 0) continue;
+
+		data_list->degrees[degree] = init_tree(forest);
+		tree_build(forest, data_list->degrees[degree], by_degree + start, size);
+	}
+
+	data_list->current_maximum = maximum;
+
+	free(by_degree);
+	free(degree_end);
+	free(tos);
+
+	//The reported entities must be the ones with the maximum
+	if (leaders != data_list->degrees[maximum]->size) return false;
+
+	for (uint32_t i = 0; i < leaders; i++) {
+		previous = leader;
+		leader = read_number(&leaders_reader);
+
+		if (leader >= count || (i > 0 && leader <= previous) || (in_set = incoming_relations(engine, entities[leader], type_id)) == NULL) return false;
+		if (in_set->count != maximum) return false;
+	}
+
+	return true;
 }
 
 /*
- * Given a Tree and a node,
- * deletes the given node
+ * Given an engine without entities and a Reader at the start of a checkpoint,
+ * loads the whole graph in the engine
+ *
+ * The hash table is sized for all the entities at once, and every tree is built with 'tree_build'.
+ * Returns FALSE if the file is not a valid checkpoint
  */
-void rb_delete(Tree *tree, node *z) {
-	node *x, *y;
+static bool load_graph(Engine *engine, Reader *reader) {
+	const char 	*magic = read_chars(reader, 8), *chars;
+	entity_t 	**entities;
+	uint32_t 	*outgoing, *sources;
+	uint32_t 	types_count, with_relations, length;
+	uint64_t 	count = 0;
+	bool 		valid = true;
 
-	if (z->left == NIL || z->right == NIL) {
-		y = z;
-	} else {
-		y = tree_successor(z);
+	if (magic == NULL || memcmp(magic, CHECKPOINT_MAGIC, 8) != 0 || read_number(reader) != CHECKPOINT_VERSION) return false;
+
+	if ((chars = read_chars(reader, sizeof(engine->log.generation))) != NULL) memcpy(&engine->log.generation, chars, sizeof(engine->log.generation));
+
+	types_count = read_number(reader);
+
+	if ((chars = read_chars(reader, sizeof(count))) != NULL) memcpy(&count, chars, sizeof(count));
+
+	//Every type and every entity takes at least 4 bytes, so bigger numbers come from a corrupted file
+	if (reader->failed || types_count > (size_t) (reader->end - reader->cursor) / 4 || count > (size_t) (reader->end - reader->cursor) / 4) return false;
+
+	for (uint32_t id = 0; id < types_count && valid; id++) {
+		length = read_number(reader);
+		chars = read_chars(reader, length);
+
+		//A type name repeated would get the id of the first one
+		valid = chars != NULL && type_intern(engine->types, (Slice) { (char *) chars, length }) == id;
 	}
 
-	if (y->left != NIL) {
-		x = y->left;
-	} else {
-		x = y->right;
+	if (!valid) return false;
+
+	hash_reserve(engine->entities, count);
+
+	entities = malloc((count + 1) * sizeof(entity_t *));
+
+	for (uint64_t i = 0; i < count && valid; i++) {
+		length = read_number(reader);
+		chars = read_chars(reader, length);
+
+		if (chars == NULL) {
+			valid = false;
+			break;
+		}
+
+		entities[i] = hash_insert(engine, engine->entities, (Slice) { (char *) chars, length });
+
+		//The IDs are sorted, so they can't be repeated
+		valid = i == 0 || compare_ids(entities[i - 1], entities[i]) < 0;
 	}
 
-	x->p = y->p;
+	if (valid) order_build(engine, entities, count);
 
-	if (y->p == NIL) {
-		tree->root = x;
-	} else if (y == y->p->left) {
-		y->p->left = x;
-	} else {
-		y->p->right = x;
+	with_relations = read_number(reader);
+	valid = valid && !reader->failed && with_relations <= types_count;
+
+	if (valid) {
+		outgoing = calloc(count + 1, sizeof(uint32_t));
+		sources = malloc((count + 1) * sizeof(uint32_t));
+
+		for (uint32_t i = 0; i < with_relations && valid; i++) {
+			valid = load_type(engine, reader, entities, count, outgoing, sources);
+		}
+
+		free(outgoing);
+		free(sources);
 	}
 
-	if (y != z) {
-		z->to = y->to;
+	free(entities);
+
+	return valid && reader->cursor == reader->end;
+}
+
+/*
+ * Given an engine without entities and the path of a checkpoint,
+ * maps the file in memory and loads the graph saved in it
+ *
+ * Returns FALSE if the file can't be read or is not a valid checkpoint
+ */
+bool load_checkpoint(Engine *engine, const char *path) {
+	int 		fd = open(path, O_RDONLY);
+	struct stat 	info;
+	char 		*map;
+	Reader 		reader;
+	bool 		loaded = false;
+
+	if (fd == -1) {
+		perror(path);
+		return false;
 	}
 
-	//Rebalances the Tree if needed
-	if (y->color == BLACK) {
-		rb_delete_fixup(tree, x);
+	if (fstat(fd, &info) == 0 && info.st_size > 0) {
+		map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (map != MAP_FAILED) {
+			madvise(map, info.st_size, MADV_SEQUENTIAL);
+
+			reader = (Reader) { map, map + info.st_size, false };
+			loaded = load_graph(engine, &reader);
+
+			munmap(map, info.st_size);
+		}
 	}
 
-	//Decrements the size of the Tree
-	tree->size = tree->size - 1;
+	close(fd);
 
-	free(y);
+	if (!loaded) fprintf(stderr, "%s: not a valid checkpoint\n", path);
+
+	return loaded;
 }
 
+/****************************/
+/*	LOG FUNCTIONS       */
+/****************************/
+
 /*
- * Given a node (root) and an entity_t,
- * recursively returns the corresponding node if present, NIL otherwise
+ * Given the path of a log and a generation,
+ * creates an empty log of that generation, replacing the one at the path through '<path>.tmp'
+ *
+ * Returns the file descriptor of the new log, -1 if it could not be created
  */
-node *tree_search(node *x, entity_t *to) {
-	//Case Tree is empty or entity_t is NULL
-	if (x == NIL || to == NULL) return x;
+static int log_create(const char *path, uint64_t generation) {
+	char 		header[8 + sizeof(uint32_t) + sizeof(uint64_t)];
+	char 		*temporary = malloc(strlen(path) + 5);
+	uint32_t 	version = LOG_VERSION;
+	int 		fd;
 
-	int 	compare = strcmp(to->id, x->to->id);
+	memcpy(header, LOG_MAGIC, 8);
+	memcpy(header + 8, &version, sizeof(version));
+	memcpy(header + 8 + sizeof(version), &generation, sizeof(generation));
 
-	node 	*toReturn;
+	sprintf(temporary, "%s.tmp", path);
 
-	//Case found
-	if (compare == 0) {
-		toReturn = x;
-	} else if (compare < 0) { //Left or right otherwise
-		toReturn = tree_search(x->left, to);
-	} else {
-		toReturn = tree_search(x->right, to);
+	fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (fd != -1 && (write(fd, header, sizeof(header)) != sizeof(header) || fsync(fd) != 0 || rename(temporary, path) != 0)) {
+		close(fd);
+		remove(temporary);
+		fd = -1;
 	}
 
-	return toReturn;
+	if (fd == -1) perror(path);
+
+	free(temporary);
+
+	return fd;
 }
 
 /*
- * Util function to initialize a Tree
+ * Given an engine and a Reader after the header of its log,
+ * executes again all the records of the log
+ *
+ * Returns a pointer to the end of the last complete record, the rest was cut by a crash while it was written
  */
-Tree *init_tree(void) {
-	Tree *tree = malloc(sizeof(Tree));
-	tree->root = NIL;
-	tree->size = 0;
+static const char *log_replay(Engine *engine, Reader *reader) {
+	const char 	*kept = reader->cursor, *kind;
+	Slice 		arguments[3];
+	int 		count;
 
-	return tree;
+	while (reader->cursor < reader->end) {
+		kind = read_chars(reader, 1);
+
+		if ((unsigned char) *kind > LOG_DELREL) break;
+
+		count = *kind == LOG_ADDREL || *kind == LOG_DELREL ? 3 : 1;
+
+		for (int i = 0; i < count; i++) {
+			arguments[i].length = read_number(reader);
+			arguments[i].start = (char *) read_chars(reader, arguments[i].length);
+		}
+
+		if (reader->failed) break;
+
+		switch (*kind) {
+			case LOG_ADDENT:
+				addent(engine, arguments[0]);
+				break;
+			case LOG_DELENT:
+				delent(engine, arguments[0]);
+				break;
+			case LOG_ADDREL:
+				addrel(engine, arguments[0], arguments[1], arguments[2]);
+				break;
+			case LOG_DELREL:
+				delrel(engine, arguments[0], arguments[1], arguments[2]);
+				break;
+		}
+
+		engine->log.records++;
+		kept = reader->cursor;
+	}
+
+	return kept;
 }
 
 /*
- * Given a node (root), recursively prints the keys,
- * returns TRUE if has printed anything, FALSE otherwise
+ * Given an engine without entities and the options with the path of the log,
+ * recovers the graph: loads the checkpoint of the log, if any, and executes again the records of the log
+ *
+ * A record cut by a crash is removed from the log, then the engine starts logging its commands after the last one.
+ * Returns FALSE if the checkpoint or the log are not valid
  */
-bool print_relation_tree(node *root) {
-	if (root != NIL) {
-		print_relation_tree(root->left);
+bool log_recover(Engine *engine, Options *options) {
+	CommandLog 	*log = &engine->log;
+	struct stat 	info;
+	char 		*map = MAP_FAILED;
+	const char 	*chars, *kept;
+	Reader 		reader;
+	uint64_t 	generation = 0;
+	off_t 		length = 0;
+	bool 		valid;
+	int 		fd;
+
+	log->path = strdup(options->log);
+	log->snapshot = malloc(strlen(log->path) + 5);
+	sprintf(log->snapshot, "%s.ckp", log->path);
+
+	//Without a checkpoint the log starts from an empty graph, with generation 0
+	if (access(log->snapshot, F_OK) == 0 && !load_checkpoint(engine, log->snapshot)) return false;
+
+	if ((fd = open(log->path, O_RDWR)) == -1) {
+		if (errno != ENOENT) {
+			perror(log->path);
+			return false;
+		}
 
-		print_string(root->to->id);
+		return (log->fd = log_create(log->path, log->generation)) != -1;
+	}
 
-		print_relation_tree(root->right);
+	if (fstat(fd, &info) == 0 && info.st_size > 0) {
+		map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
 
-		return true;
+	valid = map != MAP_FAILED;
+
+	if (valid) {
+		reader = (Reader) { map, map + info.st_size, false };
+
+		chars = read_chars(&reader, 8);
+		valid = chars != NULL && memcmp(chars, LOG_MAGIC, 8) == 0 && read_number(&reader) == LOG_VERSION;
+
+		if (valid && (chars = read_chars(&reader, sizeof(generation))) != NULL) memcpy(&generation, chars, sizeof(generation));
+
+		//A log newer than its checkpoint has lost the graph it starts from
+		valid = valid && !reader.failed && generation <= log->generation;
+
+		if (valid && generation == log->generation) {
+			kept = log_replay(engine, &reader);
+			length = kept - map;
+
+			if (kept < reader.end) fprintf(stderr, "%s: %ld bytes of incomplete records removed\n", log->path, (long) (reader.end - kept));
+		}
+
+		munmap(map, info.st_size);
+	}
+
+	if (!valid) {
+		fprintf(stderr, "%s: not a valid command log\n", log->path);
+		close(fd);
+		return false;
+	}
+
+	//The log was already compacted into the checkpoint
+	if (generation < log->generation) {
+		close(fd);
+		return (log->fd = log_create(log->path, log->generation)) != -1;
 	}
 
-	return false;
+	//New records are appended after the last complete one
+	if (ftruncate(fd, length) != 0 || lseek(fd, length, SEEK_SET) == -1) {
+		perror(log->path);
+		close(fd);
+		return false;
+	}
+
+	log->fd = fd;
+
+	return true;
 }
 
 /*
- * Prints a given Tree
+ * Given a CommandLog and an argument,
+ * appends the length and the characters of the argument to the pending records
+ */
+static inline void log_argument(CommandLog *log, Slice argument) {
+	uint32_t length = argument.length;
+
+	buffer_bytes(&log->pending, (char *) &length, sizeof(length));
+	buffer_bytes(&log->pending, argument.start, argument.length);
+}
+
+/*
+ * Given an engine, the kind of a command and its arguments,
+ * appends a record of the command to the log, before the command is executed
  *
- * Only used for debugging, space is set to 0 on the first call
+ * Compacts the log first if it has enough records, and writes the pending records
+ * if there are at least LOG_GROUP_BYTES of them
  */
-void print_tree(node * root, int space) {
-	if (root == NIL) return;
+void log_command(Engine *engine, LogKind kind, Slice arg1, Slice arg2, Slice arg3) {
+	CommandLog 	*log = &engine->log;
+	char 		byte = kind;
 
-	space += 20;
+	if (log->fd == -1) return;
 
-	if (root->right != NIL)
-		print_tree(root->right, space);
+	if (log->compact_records > 0 && log->records >= log->compact_records) {
+		log_compact(engine);
 
-	printf("\n");
+		if (log->fd == -1) return;
+	}
 
-	for (int i = 20; i < space; i++)
-		printf(" ");
+	buffer_bytes(&log->pending, &byte, 1);
+	log_argument(log, arg1);
+
+	if (kind == LOG_ADDREL || kind == LOG_DELREL) {
+		log_argument(log, arg2);
+		log_argument(log, arg3);
+	}
+
+	log->records++;
+
+	if (log->pending.length >= LOG_GROUP_BYTES) log_commit(log);
+}
+
+/*
+ * Given a CommandLog,
+ * writes all the pending records with a single 'write' and waits for them to be on disk
+ *
+ * Stops logging if the log can't be written, since the graph could not be recovered from it anyway
+ */
+void log_commit(CommandLog *log) {
+	size_t 	written = 0;
+	ssize_t bytes;
 
-	printf("%s\n", root->to->id);
+	if (log->fd == -1 || log->pending.length == 0) return;
 
-	if (root->left != NIL)
-		print_tree(root->left, space);
+	while (written < log->pending.length) {
+		bytes = write(log->fd, log->pending.bytes + written, log->pending.length - written);
+
+		if (bytes < 0) {
+			//Interrupted by a signal, writes again
+			if (errno == EINTR) continue;
+			break;
+		}
+
+		written += bytes;
+	}
+
+	if (written < log->pending.length || fdatasync(log->fd) != 0) {
+		perror(log->path);
+		close(log->fd);
+		log->fd = -1;
+	}
+
+	log->pending.length = 0;
 }
 
 /*
- * Prints a given string adding double quotes and a space after it
+ * Given an engine logging its commands,
+ * writes the graph to the checkpoint of the log with the next generation,
+ * then replaces the log with an empty one of the same generation
+ *
+ * If the checkpoint can't be written the log is kept, and compacted again after as many records
  */
-void print_string(char *string) {
-	int length = strlen(string);
+void log_compact(Engine *engine) {
+	CommandLog 	*log = &engine->log;
+	int 		fd;
 
-	//Using fputc since it's faster than printf
-	fputc_unlocked('\"', stdout);
+	log_commit(log);
 
-	for (int i = 0; i < length; i++) {
-		fputc_unlocked(string[i], stdout);
+	if (log->fd == -1) return;
+
+	log->generation++;
+
+	if (!write_checkpoint(engine, log->snapshot)) {
+		log->generation--;
+		log->records = 0;
+		return;
 	}
 
-	fputc_unlocked('\"', stdout);
-	fputc_unlocked(' ', stdout);
+	//The old log is already in the checkpoint, recovery would ignore it
+	fd = log_create(log->path, log->generation);
+
+	close(log->fd);
+	log->fd = fd;
+	log->records = 0;
+}
+
+/*
+ * Frees the paths and the pending records of the given CommandLog, and closes it
+ */
+void clear_log(CommandLog *log) {
+	if (log->fd != -1) close(log->fd);
+
+	free(log->path);
+	free(log->snapshot);
+	free(log->pending.bytes);
 }
@@ -0,0 +1,16 @@
+#!/bin/sh
+#
+# Determinism of the worker threads on the public tests
+#
+# main.c is run serially and with 2, 3 and 4 worker threads, every run must give the expected
+# outputs and the same bytes as the serial one.
+#
+# Usage: public_tests/check_threads.sh, CC and CFLAGS are used to build main.c
+
+set -e
+
+. "$(dirname "$0")/../benchmarks/common.sh"
+
+build main
+
+"$ROOT/public_tests/compare.sh" "$WORK/main" "$WORK/main -t 2" "$WORK/main -t 3" "$WORK/main -t 4"
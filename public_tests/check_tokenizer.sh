@@ -0,0 +1,26 @@
+#!/bin/sh
+#
+# Parity of the tokenizers of 'process_lines' on the public tests
+#
+# main.c is built with the AVX2 scanner, with the SSE2 one and with TOKENIZER_SCALAR, every build
+# must give the expected outputs and the same bytes as the others.
+# The AVX2 build is skipped if the CPU does not support it.
+#
+# Usage: public_tests/check_tokenizer.sh, CC and CFLAGS are used to build main.c
+
+set -e
+
+. "$(dirname "$0")/../benchmarks/common.sh"
+
+build main_scalar -DTOKENIZER_SCALAR
+build main_sse2 -mno-avx2
+set -- "$WORK/main_scalar" "$WORK/main_sse2"
+
+if grep -qw avx2 /proc/cpuinfo 2>/dev/null; then
+	build main_avx2 -mavx2
+	set -- "$@" "$WORK/main_avx2"
+else
+	echo "AVX2 not supported, skipped"
+fi
+
+"$ROOT/public_tests/compare.sh" "$@"
@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# Runs every public test with the given commands and compares their outputs
+#
+# The output of the first command is checked against the expected '.py.out' (the expected files
+# have no space at the end of the lines, so those are ignored), the output of every other command
+# must be the same as the one of the first command, byte for byte.
+#
+# Usage: public_tests/compare.sh "command" ["command"...], e.g. public_tests/compare.sh ./main "./main -t 2"
+# Exits with 1 if any output is different
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d)
+FAILED=0
+
+trap 'rm -rf "$WORK"' EXIT
+
+for input in "$DIR"/suite*/*.in; do
+	name=$(basename "$(dirname "$input")")/$(basename "$input" .in)
+	reference=""
+
+	for command in "$@"; do
+		output="$WORK/output"
+
+		if ! sh -c "$command" < "$input" > "$output"; then
+			echo "FAIL $name: '$command' exited with an error"
+			FAILED=1
+			continue
+		fi
+
+		if [ -z "$reference" ]; then
+			reference="$WORK/reference"
+			mv "$output" "$reference"
+
+			if ! sed 's/ *$//' "$reference" | cmp -s - "${input%.in}.py.out"; then
+				echo "FAIL $name: '$command' differs from ${input%.in}.py.out"
+				FAILED=1
+			fi
+		elif ! cmp -s "$reference" "$output"; then
+			echo "FAIL $name: '$command' differs from '$1'"
+			FAILED=1
+		fi
+	done
+done
+
+[ "$FAILED" = 0 ] && echo "$# commands, all the outputs are the same"
+
+exit "$FAILED"